@@ -0,0 +1,302 @@
+// End to end throughput of the AutoReflect executable on a synthetic project
+// Usage: GeneratorBench [options]
+//   --generator PATH       AutoReflect executable to measure (defaults to the one built alongside)
+//   --baseline PATH        Second executable run on the same project, results are compared against it
+//                          Builds without --trace still run, they just report no phase split
+//   --headers N            Number of headers (default 100)
+//   --classes N            Reflected classes per header (default 10)
+//   --template-depth N     Nested class templates per header (default 2)
+//   --enums N              Scoped enums per header (default 4)
+//   --fanout N             Every header includes the N headers before it (default 8)
+//   --runs N               Repetitions of each scenario, the median is reported (default 3)
+//   -j N                   Passed through to AutoReflect
+//   --dir PATH             Where the project is written (default a directory in the system temp path)
+// Every scenario runs the generator with --trace, the per phase split comes from that trace
+// Runs offline against whichever clang is first on PATH
+// POSIX only, the generator is launched with fork and waited for with wait4 to get its resource usage
+
+#include <nlohmann/json.hpp>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <filesystem>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+    struct ProjectParams {
+        int Headers = 100;
+        int Classes = 10;
+        int TemplateDepth = 2;
+        int Enums = 4;
+        int Fanout = 8;
+    };
+
+    std::string HeaderName(int Index) {
+        return "Header" + std::to_string(Index) + ".hpp";
+    }
+
+    // Header i includes the Fanout headers before it, and its classes hold members of their types
+    std::string GenerateHeader(ProjectParams const& Params, int Index) {
+        std::stringstream Out;
+        std::string const Id = std::to_string(Index);
+
+        Out << "#pragma once" << std::endl << std::endl;
+        Out << "#include <string>" << std::endl;
+        Out << "#include <vector>" << std::endl;
+        Out << "#include <map>" << std::endl;
+        for (int i = std::max(Index - Params.Fanout, 0); i < Index; ++i) {
+            Out << "#include \"" << HeaderName(i) << "\"" << std::endl;
+        }
+        Out << std::endl << "namespace AutoReflect {" << std::endl;
+
+        for (int e = 0; e < Params.Enums; ++e) {
+            Out << "enum class Enum" << Id << "_" << e << " : int { A, B, C };" << std::endl;
+        }
+
+        // Each level wraps the one below it
+        for (int d = 0; d < Params.TemplateDepth; ++d) {
+            Out << "template<typename T>" << std::endl;
+            Out << "class Wrap" << Id << "_" << d << " {" << std::endl;
+            Out << "public:" << std::endl;
+            if (d == 0) Out << "    T Value;" << std::endl;
+            else Out << "    Wrap" << Id << "_" << (d - 1) << "<T> Inner;" << std::endl;
+            Out << "    std::vector<T> Values;" << std::endl;
+            Out << "};" << std::endl;
+        }
+
+        for (int c = 0; c < Params.Classes; ++c) {
+            Out << "class Class" << Id << "_" << c << " {" << std::endl;
+            Out << "public:" << std::endl;
+            Out << "    int Int;" << std::endl;
+            Out << "    float Float;" << std::endl;
+            Out << "    std::string String;" << std::endl;
+            Out << "    std::vector<int> Ints;" << std::endl;
+            Out << "    std::map<std::string, float> Map;" << std::endl;
+            if (Params.Enums > 0) Out << "    Enum" << Id << "_" << (c % Params.Enums) << " Enum;" << std::endl;
+            if (Params.TemplateDepth > 0) Out << "    Wrap" << Id << "_" << (Params.TemplateDepth - 1) << "<int> Wrapped;" << std::endl;
+            if (c > 0) Out << "    Class" << Id << "_" << (c - 1) << " Previous;" << std::endl;
+            if (Index > 0 && Params.Fanout > 0) Out << "    Class" << (Index - 1) << "_0 Included;" << std::endl;
+            Out << "};" << std::endl;
+        }
+
+        Out << "}" << std::endl << std::endl;
+        Out << "#include \"" << HeaderName(Index) << ".gen.inl\"" << std::endl;
+        return Out.str();
+    }
+
+    void WriteFile(std::filesystem::path const& Path, std::string const& Contents) {
+        std::ofstream File(Path);
+        File << Contents;
+        if (!File) throw std::runtime_error("Could not write " + Path.string());
+    }
+
+    void WriteProject(ProjectParams const& Params, std::filesystem::path const& Dir) {
+        std::filesystem::create_directories(Dir);
+
+        std::stringstream Main;
+        for (int i = 0; i < Params.Headers; ++i) {
+            WriteFile(Dir / HeaderName(i), GenerateHeader(Params, i));
+            Main << "#include \"" << HeaderName(i) << "\"" << std::endl;
+        }
+        Main << std::endl << "#include \"main.cpp.gen.inl\"" << std::endl;
+        Main << std::endl << "int main() { return 0; }" << std::endl;
+        WriteFile(Dir / "main.cpp", Main.str());
+    }
+
+    // Removes generated files and the generator's state, the next run starts cold
+    void CleanProject(std::filesystem::path const& Dir) {
+        std::filesystem::remove_all(Dir / ".AutoReflect");
+        for (auto const& Entry : std::filesystem::directory_iterator(Dir)) {
+            std::string const Name = Entry.path().filename().string();
+            if (Name.find(".gen.") != std::string::npos) std::filesystem::remove(Entry.path());
+        }
+    }
+
+    struct RunResult {
+        double WallSeconds = 0;
+        double MaxRSSMiB = 0;
+
+        // From the trace
+        double GeneratorRSSMiB = 0;
+        int FilesParsed = 0;
+        std::map<std::string, double> PhaseSeconds;
+    };
+
+    RunResult RunGenerator(std::filesystem::path const& Generator, std::filesystem::path const& Dir, ProjectParams const& Params, int Jobs) {
+        std::filesystem::path const TracePath = Dir / "GeneratorBench.trace.json";
+        std::filesystem::remove(TracePath);
+
+        std::vector<std::string> Args = { Generator.string(), "-S", "--trace", TracePath.string(), "-M", "main.cpp" };
+        if (Jobs > 0) {
+            Args.push_back("-j");
+            Args.push_back(std::to_string(Jobs));
+        }
+        for (int i = 0; i < Params.Headers; ++i) Args.push_back(HeaderName(i));
+
+        std::vector<char*> Argv;
+        for (auto& Arg : Args) Argv.push_back(Arg.data());
+        Argv.push_back(nullptr);
+
+        auto const Start = std::chrono::steady_clock::now();
+
+        pid_t const Pid = fork();
+        if (Pid < 0) throw std::runtime_error("fork failed");
+        if (Pid == 0) {
+            if (chdir(Dir.c_str()) != 0) _exit(127);
+            execv(Argv[0], Argv.data());
+            _exit(127);
+        }
+
+        // The usage wait4 reports covers the generator and every clang it waited for
+        int Status = 0;
+        struct rusage Usage;
+        if (wait4(Pid, &Status, 0, &Usage) != Pid) throw std::runtime_error("wait4 failed");
+
+        RunResult Result;
+        Result.WallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+        Result.MaxRSSMiB = Usage.ru_maxrss / 1024.0;
+        if (!WIFEXITED(Status) || WEXITSTATUS(Status) != 0) {
+            throw std::runtime_error(Generator.string() + " failed with status " + std::to_string(Status));
+        }
+
+        std::ifstream TraceFile(TracePath);
+        if (!TraceFile) return Result;
+        nlohmann::json const Trace = nlohmann::json::parse(TraceFile);
+        Result.GeneratorRSSMiB = Trace["otherData"].value("PeakRSSKiB", 0) / 1024.0;
+        for (auto const& Event : Trace["traceEvents"]) {
+            if (Event["ph"] != "X") continue;
+            std::string const Name = Event["name"];
+            Result.PhaseSeconds[Name] += Event["dur"].get<double>() / 1e6;
+            if (Name == "GenerateFile") ++Result.FilesParsed;
+        }
+
+        return Result;
+    }
+
+    RunResult Median(std::vector<RunResult> Results) {
+        std::sort(Results.begin(), Results.end(), [](RunResult const& A, RunResult const& B) { return A.WallSeconds < B.WallSeconds; });
+        return Results[Results.size() / 2];
+    }
+
+    struct SuiteResult {
+        RunResult Cold, Warm, Touched;
+    };
+
+    SuiteResult RunSuite(std::filesystem::path const& Generator, std::filesystem::path const& Dir, ProjectParams const& Params, int Jobs, int Runs) {
+        std::vector<RunResult> Cold, Warm, Touched;
+        std::filesystem::path const TouchedHeader = Dir / HeaderName(Params.Headers - 1);
+
+        for (int Run = 0; Run < Runs; ++Run) {
+            CleanProject(Dir);
+            Cold.push_back(RunGenerator(Generator, Dir, Params, Jobs));
+            Warm.push_back(RunGenerator(Generator, Dir, Params, Jobs));
+
+            // The last header is included by nothing but main.cpp, only its own TU has to be parsed again
+            // The dependency graph compares contents, so the change has to be real
+            {
+                std::ofstream Header(TouchedHeader, std::ios::app);
+                Header << "// Touched " << Run << std::endl;
+            }
+            Touched.push_back(RunGenerator(Generator, Dir, Params, Jobs));
+        }
+
+        return SuiteResult { Median(Cold), Median(Warm), Median(Touched) };
+    }
+
+    void PrintRow(char const* Name, RunResult const& Result, int Headers) {
+        printf("%-10s %10.3f %10.1f %8d %14.1f %14.1f\n", Name, Result.WallSeconds, Headers / Result.WallSeconds, Result.FilesParsed, Result.GeneratorRSSMiB, Result.MaxRSSMiB);
+    }
+
+    void PrintSuite(char const* Title, SuiteResult const& Suite, int Headers) {
+        printf("\n%s\n", Title);
+        printf("%-10s %10s %10s %8s %14s %14s\n", "Scenario", "Wall (s)", "Files/s", "Parsed", "RSS (MiB)", "Max RSS (MiB)");
+        PrintRow("cold", Suite.Cold, Headers);
+        PrintRow("warm", Suite.Warm, Headers);
+        PrintRow("touched", Suite.Touched, Headers);
+
+        // Phases nest and run on several threads at once, so they add up to more than the wall time
+        printf("\nPhase split of the cold run, summed over threads (s)\n");
+        std::vector<std::pair<std::string, double>> Phases(Suite.Cold.PhaseSeconds.begin(), Suite.Cold.PhaseSeconds.end());
+        std::sort(Phases.begin(), Phases.end(), [](auto const& A, auto const& B) { return A.second > B.second; });
+        for (auto const& [Name, Seconds] : Phases) {
+            printf("  %-16s %10.3f\n", Name.c_str(), Seconds);
+        }
+    }
+
+    int ParseInt(int argc, char** argv, int& i) {
+        if (i + 1 >= argc) throw std::runtime_error(std::string("Missing value for ") + argv[i]);
+        return std::max(std::stoi(argv[++i]), 0);
+    }
+}
+
+int main(int argc, char** argv) {
+    try {
+        ProjectParams Params;
+#ifdef AR_GENERATOR_PATH
+        std::filesystem::path Generator = AR_GENERATOR_PATH;
+#else
+        std::filesystem::path Generator;
+#endif
+        std::filesystem::path Baseline;
+        std::filesystem::path Dir = std::filesystem::temp_directory_path() / "AutoReflectGeneratorBench";
+        int Runs = 3;
+        int Jobs = 0;
+
+        for (int i = 1; i < argc; ++i) {
+            std::string const Arg = argv[i];
+            if (Arg == "--generator" && i + 1 < argc) Generator = argv[++i];
+            else if (Arg == "--baseline" && i + 1 < argc) Baseline = argv[++i];
+            else if (Arg == "--dir" && i + 1 < argc) Dir = argv[++i];
+            else if (Arg == "--headers") Params.Headers = std::max(ParseInt(argc, argv, i), 1);
+            else if (Arg == "--classes") Params.Classes = ParseInt(argc, argv, i);
+            else if (Arg == "--template-depth") Params.TemplateDepth = ParseInt(argc, argv, i);
+            else if (Arg == "--enums") Params.Enums = ParseInt(argc, argv, i);
+            else if (Arg == "--fanout") Params.Fanout = ParseInt(argc, argv, i);
+            else if (Arg == "--runs") Runs = std::max(ParseInt(argc, argv, i), 1);
+            else if (Arg == "-j") Jobs = ParseInt(argc, argv, i);
+            else throw std::runtime_error("Unknown argument " + Arg);
+        }
+
+        if (Generator.empty()) throw std::runtime_error("No generator given, pass --generator");
+        Generator = std::filesystem::absolute(Generator);
+        if (!Baseline.empty()) Baseline = std::filesystem::absolute(Baseline);
+
+        printf("Project: %d headers, %d classes per header, template depth %d, %d enums per header, fan-out %d\n",
+            Params.Headers, Params.Classes, Params.TemplateDepth, Params.Enums, Params.Fanout);
+        printf("Median of %d runs, written to %s\n", Runs, Dir.string().c_str());
+
+        std::filesystem::remove_all(Dir);
+        WriteProject(Params, Dir);
+
+        SuiteResult const Result = RunSuite(Generator, Dir, Params, Jobs, Runs);
+        PrintSuite(Generator.string().c_str(), Result, Params.Headers);
+
+        if (!Baseline.empty()) {
+            // Same sources, the touched header only gains comments
+            SuiteResult const BaselineResult = RunSuite(Baseline, Dir, Params, Jobs, Runs);
+            PrintSuite(Baseline.string().c_str(), BaselineResult, Params.Headers);
+
+            printf("\nSpeedup over the baseline\n");
+            printf("  cold    %6.2fx\n", BaselineResult.Cold.WallSeconds / Result.Cold.WallSeconds);
+            printf("  warm    %6.2fx\n", BaselineResult.Warm.WallSeconds / Result.Warm.WallSeconds);
+            printf("  touched %6.2fx\n", BaselineResult.Touched.WallSeconds / Result.Touched.WallSeconds);
+        }
+    } catch (std::exception const& Ex) {
+        std::cerr << Ex.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
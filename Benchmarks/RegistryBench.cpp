@@ -0,0 +1,127 @@
+// Compares the SubclassOf type lookups in the main implementation against the if-chains they replaced
+// Usage: RegistryBench [lookups]
+// The registry holds 5000 types, the chains are modelled as a scan comparing against every name or type_info in turn
+
+#include <AutoReflectDecls.hpp>
+
+#include <iostream>
+#include <chrono>
+#include <random>
+
+namespace {
+    constexpr int NumTypes = 5000;
+
+    template<typename F>
+    double Time(F&& Func) {
+        auto const Start = std::chrono::steady_clock::now();
+        Func();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+    }
+}
+
+template<int I>
+class BenchType {
+public:
+    int Value = I;
+};
+
+template<int I>
+void SerializeFields(Serializer& Ser, BenchType<I> const& Val) {
+    Serialize(Ser, "Value", Val.Value);
+}
+
+template<int I>
+void DeserializeFields(Deserializer& Ser, BenchType<I>& Val) {
+    Deserialize(Ser, "Value", Val.Value);
+}
+
+// Names share a long prefix, like types in one namespace
+template<int I>
+struct BenchName {
+    static constexpr std::array<char, 32> Value = []() {
+        std::array<char, 32> Name {};
+        std::string_view const Prefix = "AutoReflect::BenchType";
+        size_t Length = 0;
+        for (char C : Prefix) Name[Length++] = C;
+        char Digits[8] = {};
+        int NumDigits = 0;
+        int Remaining = I;
+        do {
+            Digits[NumDigits++] = static_cast<char>('0' + Remaining % 10);
+            Remaining /= 10;
+        } while (Remaining);
+        while (NumDigits) Name[Length++] = Digits[--NumDigits];
+        return Name;
+    }();
+};
+
+template<int... I>
+constexpr std::array<SubclassTableEntry, sizeof...(I)> MakeEntries(std::integer_sequence<int, I...>) {
+    return {{ { 0, BenchName<I>::Value.data(), &typeid(BenchType<I>), &SerializeSubclassFields<BenchType<I>>, &DeserializeSubclassFields<BenchType<I>> }... }};
+}
+
+static constexpr auto Entries = MakeEntries(std::make_integer_sequence<int, NumTypes>());
+static constexpr auto SubclassTable = MakeSubclassTable(Entries);
+
+static SubclassTableEntry const* ChainFind(std::string const& Name) {
+    for (SubclassTableEntry const& Entry : Entries) {
+        if (Name == Entry.Name) return &Entry;
+    }
+    return nullptr;
+}
+
+static SubclassTableEntry const* ChainFind(std::type_info const& Type) {
+    for (SubclassTableEntry const& Entry : Entries) {
+        if (Type == *Entry.Type) return &Entry;
+    }
+    return nullptr;
+}
+
+int main(int argc, char** argv) {
+    size_t const Lookups = argc > 1 ? std::stoul(argv[1]) : 200000;
+
+    std::mt19937 Random(1234);
+    std::uniform_int_distribution<int> Pick(0, NumTypes - 1);
+    std::vector<std::string> Names;
+    std::vector<std::type_info const*> Types;
+    for (size_t i = 0; i < Lookups; ++i) {
+        SubclassTableEntry const& Entry = Entries[Pick(Random)];
+        Names.push_back(Entry.Name);
+        Types.push_back(Entry.Type);
+    }
+
+    std::unordered_map<std::type_index, SubclassTableEntry const*> const ByType = IndexSubclassTable(SubclassTable);
+
+    // Both must find the same entries before their timings mean anything
+    for (size_t i = 0; i < std::min<size_t>(Lookups, 1000); ++i) {
+        SubclassTableEntry const* Found = FindSubclass(SubclassTable, Names[i]);
+        SubclassTableEntry const* Expected = ChainFind(Names[i]);
+        if (!Found || !Expected || Found->DeserializeFields != Expected->DeserializeFields || ByType.at(*Types[i])->SerializeFields != ChainFind(*Types[i])->SerializeFields) {
+            std::cerr << "Lookups disagree on " << Names[i] << std::endl;
+            return 1;
+        }
+    }
+
+    size_t Sink = 0;
+    double const ChainNameTime = Time([&]() {
+        for (std::string const& Name : Names) Sink += ChainFind(Name)->Hash;
+    });
+    double const TableNameTime = Time([&]() {
+        for (std::string const& Name : Names) Sink += FindSubclass(SubclassTable, Name)->Hash;
+    });
+    double const ChainTypeTime = Time([&]() {
+        for (std::type_info const* Type : Types) Sink += ChainFind(*Type)->Hash;
+    });
+    double const MapTypeTime = Time([&]() {
+        for (std::type_info const* Type : Types) Sink += ByType.find(*Type)->second->Hash;
+    });
+
+    double const Count = static_cast<double>(Lookups);
+    std::cout << NumTypes << " types, " << Lookups << " lookups, " << SubclassTable.size() << " slots" << std::endl;
+    std::cout << "by name, chain: " << (ChainNameTime / Count) * 1e9 << " ns" << std::endl;
+    std::cout << "by name, table: " << (TableNameTime / Count) * 1e9 << " ns, " << ChainNameTime / TableNameTime << "x" << std::endl;
+    std::cout << "by type, chain: " << (ChainTypeTime / Count) * 1e9 << " ns" << std::endl;
+    std::cout << "by type, map:   " << (MapTypeTime / Count) * 1e9 << " ns, " << ChainTypeTime / MapTypeTime << "x (" << Sink << ")" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,167 @@
+// Compares the dump line scanners in Parsing.cpp against the regexes and string splitting they replaced
+// Usage: ScannerBench [dump.txt] [iterations]
+// The dump is the output of clang -Xclang -ast-dump, embedded sample lines are used without one
+
+#include "Parsing.hpp"
+
+#include <regex>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <chrono>
+
+namespace {
+    const std::regex ClassRegex("class ([a-zA-Z0-9_]+) definition");
+    const std::regex FieldRegex("([a-zA-Z0-9_]+) '([a-zA-Z0-9_:<>, \\*\\&\\[\\]]+)'");
+
+    std::vector<std::string> SplitForTemplate(std::string const& Val) {
+        std::vector<std::string> result;
+        result.reserve(5);
+        std::stringstream ss (Val);
+        std::string item;
+
+        while (std::getline (ss, item, ' ')) {
+            result.push_back (item);
+        }
+
+        return result;
+    }
+
+    bool RegexTemplateParams(std::string const& Line, std::string& Type, std::string& Name) {
+        auto Sections = SplitForTemplate(Line);
+        int NumDots = 0;
+        int NumVars = 0;
+        if (Sections.back()[0] >= '0' && Sections.back()[0] <= '9') {
+            Name = "";
+        } else {
+            NumVars = 1;
+            Name = Sections.back();
+        }
+        if (Sections[Sections.size() - 1 - NumVars][0] == '.') {
+            NumDots = 1;
+        }
+
+        Type = Sections[Sections.size() - NumVars - NumDots - 5];
+        return true;
+    }
+
+    const char* const SampleLines[] = {
+        "CXXRecordDecl 0x13c10c8a8 <line:4:1, line:8:1> line:4:7 class Person definition",
+        "CXXRecordDecl 0x13c10c9c8 <col:1, col:7> col:7 implicit class Person",
+        "CXXRecordDecl 0x13c10d0e0 <line:12:1, col:50> col:7 referenced class Car definition",
+        "FieldDecl 0x13c10cb60 <line:16:9, col:13> col:13 Age 'int'",
+        "FieldDecl 0x13c10cbc8 <line:17:5, col:17> col:17 Name 'std::string':'std::basic_string<char>'",
+        "FieldDecl 0x13c10cc30 <line:18:5, col:40> col:40 Children 'std::vector<std::map<int, Person *>>'",
+        "FieldDecl 0x13c10cc98 <line:19:5, col:30> col:30 Callback 'void (*)(int)'",
+        "EnumDecl 0x13c10d020 <line:11:1, col:30> col:12 class Color 'int'",
+        "EnumDecl 0x13c10d088 <line:11:1, col:30> col:12 referenced class Mode 'unsigned char'",
+        "TemplateTypeParmDecl 0x13c10d1a0 <line:9:10, col:19> col:19 referenced typename depth 0 index 0 T",
+        "NonTypeTemplateParmDecl 0x13c10d208 <col:22, col:26> col:26 'int' depth 0 index 1 N",
+        "TemplateTypeParmDecl 0x13c10d270 <col:29, col:41> col:41 typename depth 0 index 2 ... Rest",
+    };
+
+    template<typename F>
+    double Time(size_t Iterations, F&& Func) {
+        auto const Start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < Iterations; ++i) Func();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+    }
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::pair<TagType, std::string>> Lines;
+
+    auto AddLine = [&](std::string const& Line) {
+        size_t Indent = Line.find_first_not_of("-|` ");
+        if (Indent == std::string::npos) return;
+        uint32_t OutSize;
+        TagType Tag = BeginsWithValidTag(Line.data() + Indent, Line.size() - Indent, OutSize);
+        if (Tag == TagType::CXXRecordDecl || Tag == TagType::FieldDecl || Tag == TagType::EnumDecl || Tag == TagType::TemplateTypeParmDecl || Tag == TagType::NonTypeTemplateParmDecl) {
+            Lines.emplace_back(Tag, Line.substr(Indent + OutSize));
+        }
+    };
+
+    if (argc > 1) {
+        std::ifstream Dump(argv[1]);
+        if (!Dump) {
+            std::cerr << "Could not open " << argv[1] << std::endl;
+            return 1;
+        }
+        std::string Line;
+        while (std::getline(Dump, Line)) AddLine(Line);
+    } else {
+        for (const char* Line : SampleLines) AddLine(Line);
+    }
+
+    size_t const Iterations = argc > 2 ? std::stoul(argv[2]) : std::max<size_t>(1, 2000000 / std::max<size_t>(Lines.size(), 1));
+    std::cout << Lines.size() << " lines, " << Iterations << " iterations" << std::endl;
+
+    // Both must agree on every line before their timings mean anything
+    size_t Mismatches = 0;
+    for (auto const& [Tag, Line] : Lines) {
+        if (Tag == TagType::CXXRecordDecl) {
+            std::smatch Match;
+            bool const Found = std::regex_search(Line, Match, ClassRegex);
+            std::optional<std::string_view> Name = ScanClassDefinition(Line);
+            if (Found != Name.has_value() || (Found && Match[1].str() != *Name)) ++Mismatches;
+        } else if (Tag == TagType::FieldDecl) {
+            std::smatch Match;
+            bool const Found = std::regex_search(Line, Match, FieldRegex);
+            std::string_view Name, Type;
+            bool const Scanned = ScanField(Line, Name, Type);
+            if (Found != Scanned || (Found && (Match[1].str() != Name || Match[2].str() != Type))) ++Mismatches;
+        } else if (Tag != TagType::EnumDecl) {
+            std::string Type, Name;
+            std::string_view ScannedType, ScannedName;
+            RegexTemplateParams(Line, Type, Name);
+            if (!GetTemplateParams(Line, ScannedType, ScannedName) || Type != ScannedType || Name != ScannedName) ++Mismatches;
+        }
+    }
+    if (Mismatches) {
+        std::cerr << Mismatches << " lines scanned differently" << std::endl;
+        return 1;
+    }
+
+    size_t Sink = 0;
+
+    double const RegexTime = Time(Iterations, [&]() {
+        for (auto const& [Tag, Line] : Lines) {
+            std::smatch Match;
+            if (Tag == TagType::CXXRecordDecl) {
+                if (std::regex_search(Line, Match, ClassRegex)) Sink += Match[1].length();
+            } else if (Tag == TagType::FieldDecl) {
+                if (std::regex_search(Line, Match, FieldRegex)) Sink += Match[2].length();
+            } else if (Tag == TagType::EnumDecl) {
+                // The enum parsing was already hand written, only the allocation of the substring differs
+                auto ClassIndex = Line.find("class ");
+                if (ClassIndex != std::string::npos) Sink += Line.substr(ClassIndex + 6).size();
+            } else {
+                std::string Type, Name;
+                RegexTemplateParams(Line, Type, Name);
+                Sink += Type.size();
+            }
+        }
+    });
+
+    double const ScanTime = Time(Iterations, [&]() {
+        for (auto const& [Tag, Line] : Lines) {
+            std::string_view Name, Type;
+            if (Tag == TagType::CXXRecordDecl) {
+                if (std::optional<std::string_view> ClassName = ScanClassDefinition(Line)) Sink += ClassName->size();
+            } else if (Tag == TagType::FieldDecl) {
+                if (ScanField(Line, Name, Type)) Sink += Type.size();
+            } else if (Tag == TagType::EnumDecl) {
+                if (ScanEnum(Line, Name, Type)) Sink += Type.size();
+            } else {
+                if (GetTemplateParams(Line, Type, Name)) Sink += Type.size();
+            }
+        }
+    });
+
+    double const NumLines = static_cast<double>(Lines.size()) * static_cast<double>(Iterations);
+    std::cout << "regex:   " << RegexTime << "s, " << (RegexTime / NumLines) * 1e9 << " ns/line" << std::endl;
+    std::cout << "scanner: " << ScanTime << "s, " << (ScanTime / NumLines) * 1e9 << " ns/line" << std::endl;
+    std::cout << "speedup: " << RegexTime / ScanTime << "x (" << Sink << ")" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,200 @@
+#include "DependencyGraph.hpp"
+
+#include <fstream>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+std::optional<FileStamp> StatFile(std::filesystem::path const& Path) {
+#ifndef _WIN32
+    struct stat Info;
+    if (stat(Path.c_str(), &Info) != 0) return std::nullopt;
+
+    FileStamp Stamp;
+#ifdef __APPLE__
+    Stamp.MTime = static_cast<int64_t>(Info.st_mtimespec.tv_sec) * 1000000000 + Info.st_mtimespec.tv_nsec;
+#else
+    Stamp.MTime = static_cast<int64_t>(Info.st_mtim.tv_sec) * 1000000000 + Info.st_mtim.tv_nsec;
+#endif
+    Stamp.Size = static_cast<uint64_t>(Info.st_size);
+    Stamp.Inode = static_cast<uint64_t>(Info.st_ino);
+    return Stamp;
+#else
+    std::error_code Ec;
+    auto const WriteTime = std::filesystem::last_write_time(Path, Ec);
+    if (Ec) return std::nullopt;
+    auto const Size = std::filesystem::file_size(Path, Ec);
+    if (Ec) return std::nullopt;
+
+    FileStamp Stamp;
+    Stamp.MTime = static_cast<int64_t>(WriteTime.time_since_epoch().count());
+    Stamp.Size = static_cast<uint64_t>(Size);
+    return Stamp;
+#endif
+}
+
+void DependencyGraph::Load(std::filesystem::path const& Path) {
+    std::ifstream File(Path);
+    if (!File) return;
+
+    std::lock_guard<std::mutex> Lock(Mutex);
+    try {
+        nlohmann::json J = nlohmann::json::parse(File);
+
+        for (auto const& [TU, Deps] : J["TranslationUnits"].items()) {
+            TranslationUnits[TU] = Deps.get<std::vector<std::string>>();
+        }
+
+        for (auto const& [Name, Stamp] : J["Files"].items()) {
+            Files[Name] = FileStamp { Stamp[0].get<int64_t>(), Stamp[1].get<uint64_t>(), Stamp[2].get<uint64_t>(), Stamp[3].get<uint64_t>() };
+        }
+    } catch (nlohmann::json::exception const&) {
+        // Forget everything, all TUs will be regenerated
+        TranslationUnits.clear();
+        Files.clear();
+    }
+}
+
+void DependencyGraph::Save(std::filesystem::path const& Path) const {
+    std::lock_guard<std::mutex> Lock(Mutex);
+
+    nlohmann::json J;
+    nlohmann::json& TUsJSON = J["TranslationUnits"];
+    TUsJSON = nlohmann::json::object();
+    for (auto const& kvp : TranslationUnits) {
+        TUsJSON[kvp.first] = kvp.second;
+    }
+
+    // Only keep stamps for files that are still referenced
+    nlohmann::json& FilesJSON = J["Files"];
+    FilesJSON = nlohmann::json::object();
+    for (auto const& kvp : TranslationUnits) {
+        for (auto const& Dep : kvp.second) {
+            auto const Found = Files.find(Dep);
+            if (Found == Files.end()) continue;
+            FilesJSON[Dep] = nlohmann::json::array({ Found->second.MTime, Found->second.Size, Found->second.Inode, Found->second.Hash });
+        }
+    }
+
+    std::filesystem::create_directories(Path.parent_path());
+    std::ofstream File(Path);
+    File << J.dump();
+}
+
+void DependencyGraph::Sweep(WorkerPool& Pool) {
+    SweepFiles(Pool, GetFiles());
+}
+
+std::vector<std::string> DependencyGraph::GetFiles() const {
+    std::lock_guard<std::mutex> Lock(Mutex);
+
+    std::vector<std::string> Names;
+    for (auto const& kvp : Files) Names.push_back(kvp.first);
+    return Names;
+}
+
+std::vector<std::string> DependencyGraph::GetDependencies(std::filesystem::path const& TranslationUnit) const {
+    std::lock_guard<std::mutex> Lock(Mutex);
+
+    auto const Found = TranslationUnits.find(TranslationUnit.string());
+    return (Found != TranslationUnits.end()) ? Found->second : std::vector<std::string>();
+}
+
+void DependencyGraph::SweepFiles(WorkerPool& Pool, std::vector<std::string> const& Names) {
+    std::vector<FileStamp> Recorded;
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        for (auto const& Name : Names) {
+            auto const Found = Files.find(Name);
+            Recorded.push_back(Found != Files.end() ? Found->second : FileStamp { });
+        }
+    }
+
+    std::vector<size_t> Indices(Names.size());
+    for (size_t i = 0; i < Indices.size(); ++i) Indices[i] = i;
+
+    std::vector<char> Changed(Names.size(), 0);
+    std::vector<std::optional<FileStamp>> Refreshed(Names.size());
+    Pool.ParallelFor([&Names, &Recorded, &Changed, &Refreshed](size_t const& i) {
+        std::optional<FileStamp> Current = StatFile(Names[i]);
+        if (!Current) {
+            Changed[i] = 1;
+            return;
+        }
+        if (Current->SameStat(Recorded[i])) return;
+
+        // Touched, but only a different hash means it changed
+        std::optional<uint64_t> Hash = HashFile(Names[i]);
+        if (!Hash || *Hash != Recorded[i].Hash) {
+            Changed[i] = 1;
+            return;
+        }
+
+        Current->Hash = *Hash;
+        Refreshed[i] = Current;
+    }, Indices);
+
+    std::lock_guard<std::mutex> Lock(Mutex);
+    ChangedFiles.clear();
+    for (size_t i = 0; i < Names.size(); ++i) {
+        if (Changed[i]) ChangedFiles.insert(Names[i]);
+        if (Refreshed[i]) Files[Names[i]] = *Refreshed[i];
+    }
+}
+
+std::optional<std::string> DependencyGraph::FindChangedDependency(std::filesystem::path const& TranslationUnit) const {
+    std::lock_guard<std::mutex> Lock(Mutex);
+
+    auto const Found = TranslationUnits.find(TranslationUnit.string());
+    if (Found == TranslationUnits.end()) return TranslationUnit.string();
+
+    for (auto const& Dep : Found->second) {
+        if (ChangedFiles.find(Dep) != ChangedFiles.end() || Files.find(Dep) == Files.end()) {
+            return Dep;
+        }
+    }
+
+    return std::nullopt;
+}
+
+void DependencyGraph::Update(std::filesystem::path const& TranslationUnit, std::vector<std::string> const& Dependencies) {
+    // The TU is always its own dependency, even if clang failed to report anything
+    std::vector<std::string> AllDependencies = Dependencies;
+    if (std::find(AllDependencies.begin(), AllDependencies.end(), TranslationUnit.string()) == AllDependencies.end()) {
+        AllDependencies.insert(AllDependencies.begin(), TranslationUnit.string());
+    }
+
+    std::vector<std::pair<std::string, FileStamp>> Stamps;
+    for (auto const& Dep : AllDependencies) {
+        std::optional<FileStamp> Stamp = StatFile(Dep);
+        if (!Stamp) continue;
+
+        // Headers shared by many TUs are only hashed again if their stat changed
+        bool KnownHash = false;
+        {
+            std::lock_guard<std::mutex> Lock(Mutex);
+            auto const Found = Files.find(Dep);
+            if (Found != Files.end() && Found->second.SameStat(*Stamp)) {
+                Stamp->Hash = Found->second.Hash;
+                KnownHash = true;
+            }
+        }
+
+        if (!KnownHash) {
+            std::optional<uint64_t> Hash = HashFile(Dep);
+            if (!Hash) continue;
+            Stamp->Hash = *Hash;
+        }
+
+        Stamps.emplace_back(Dep, *Stamp);
+    }
+
+    std::lock_guard<std::mutex> Lock(Mutex);
+    std::vector<std::string>& Recorded = TranslationUnits[TranslationUnit.string()];
+    Recorded.clear();
+    for (auto const& [Dep, Stamp] : Stamps) {
+        Recorded.push_back(Dep);
+        Files[Dep] = Stamp;
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "Utilities.hpp"
+
+#include <map>
+#include <mutex>
+
+// Stat information used as a shortcut, and the content hash that decides if a file really changed
+struct FileStamp {
+    int64_t MTime = 0;
+    uint64_t Size = 0;
+    uint64_t Inode = 0;
+    uint64_t Hash = 0;
+
+    // If the stat information matches, the file is assumed unchanged without hashing it
+    bool SameStat(FileStamp const& Other) const {
+        return MTime == Other.MTime && Size == Other.Size && Inode == Other.Inode;
+    }
+};
+
+// Fills in everything but the hash
+std::optional<FileStamp> StatFile(std::filesystem::path const& Path);
+
+// Persisted map of every translation unit to the files it included, and the stamp each file had when recorded
+class DependencyGraph {
+private:
+    std::map<std::string, std::vector<std::string>> TranslationUnits;
+    std::map<std::string, FileStamp> Files;
+
+    // Result of the last Sweep, files whose contents no longer match
+    // Not updated by Update, so TUs sharing a changed header are all seen as stale
+    std::set<std::string> ChangedFiles;
+
+    mutable std::mutex Mutex;
+public:
+    void Load(std::filesystem::path const& Path);
+    void Save(std::filesystem::path const& Path) const;
+
+    // Stats every recorded file once, in parallel, and hashes the ones whose stat changed
+    void Sweep(WorkerPool& Pool);
+
+    // Same as Sweep, but only checks the given files, everything else is assumed unchanged
+    void SweepFiles(WorkerPool& Pool, std::vector<std::string> const& Names);
+
+    std::vector<std::string> GetFiles() const;
+
+    // Everything the TU included when it was last recorded, including the TU itself
+    std::vector<std::string> GetDependencies(std::filesystem::path const& TranslationUnit) const;
+
+    // Returns the first dependency that changed since it was recorded, or the TU itself if it was never recorded
+    std::optional<std::string> FindChangedDependency(std::filesystem::path const& TranslationUnit) const;
+
+    // Replaces the recorded dependencies of a TU, stamping and hashing them as they are now
+    void Update(std::filesystem::path const& TranslationUnit, std::vector<std::string> const& Dependencies);
+};
@@ -1,77 +1,164 @@
 #include "Generating.hpp"
 
-#include <fstream>
-#include <sstream>
-
-std::string PathToString(std::filesystem::path const& Path) {
-    std::string Str = Path.string();
-    for (auto& C : Str) {
-        if (C == '/') C = '_';
-    }
-    return Str;
-}
-
 bool ImplementationGenerator::operator==(ImplementationGenerator const& Other) const {
     return
         Templates == Other.Templates &&
         FullTypeName == Other.FullTypeName &&
         SerializeFieldsSource == Other.SerializeFieldsSource &&
-        DeserializeFieldsSource == Other.DeserializeFieldsSource;
+        DeserializeFieldsSource == Other.DeserializeFieldsSource &&
+        FieldNames == Other.FieldNames;
 }
 
 bool ImplementationGenerator::operator!=(ImplementationGenerator const& Other) const {
     return !(*this == Other);
 }
 
-std::string ImplementationGenerator::Generate(GenMode Mode) const {
-    std::string Qualifier = (!Templates.empty() || Mode == GenMode::InlineMode) ? "inline " : "";
-
-    if (!Templates.empty()) {
-        Qualifier = Templates + "\n" + Qualifier;
+std::string const& ImplementationGenerator::GetMacroName() const {
+    if (MacroName.empty()) {
+        MacroName = FullTypeName;
+        for (char& C : MacroName) {
+            if (C == ':' || C == '<' || C == '>' || C == ',') C = '_';
+        }
     }
+    return MacroName;
+}
 
-    std::string GeneratedSource;
+void ImplementationGenerator::Generate(CodeWriter& Out, GenMode Mode) const {
+    auto WriteQualifier = [&]() -> CodeWriter& {
+        if (!Templates.empty()) Out << Templates << '\n';
+        if (!Templates.empty() || Mode == GenMode::InlineMode || Mode == GenMode::InlineForwardDeclMode) Out << "inline ";
+        return Out;
+    };
+
+    // Comes first in every mode, the traits have to be declared before anything uses them
+    {
+        std::string const& Macro = GetMacroName();
+        std::string const TemplateHead = Templates.empty() ? "template<>" : Templates;
+        Out << "#ifndef " << Macro << "_TRAITS\n";
+        Out << "#define " << Macro << "_TRAITS\n";
+
+        // Offsets of classes that aren't standard layout are conditionally supported, which GCC and clang do
+        Out << "#ifdef __GNUC__\n";
+        Out << "#pragma GCC diagnostic push\n";
+        Out << "#pragma GCC diagnostic ignored \"-Winvalid-offsetof\"\n";
+        Out << "#endif\n";
+        Out << TemplateHead << '\n';
+        Out << "struct FieldTable<" << FullTypeName << "> {\n";
+        Out << "    using Type = " << FullTypeName << ";\n";
+        Out << "    static constexpr auto Fields = std::make_tuple(";
+        for (size_t i = 0; i < FieldNames.size(); ++i) {
+            std::string const& Field = FieldNames[i];
+            Out << (i ? ",\n" : "\n") << "        MakeField(\"" << Field << "\", &Type::" << Field << ", offsetof(Type, " << Field << "))";
+        }
+        Out << ");\n";
+        Out << "};\n";
+        Out << "#ifdef __GNUC__\n";
+        Out << "#pragma GCC diagnostic pop\n";
+        Out << "#endif\n";
+
+        if (!FieldNames.empty()) {
+            Out << TemplateHead << '\n';
+            Out << "struct BulkTraits<" << FullTypeName << "> : BulkFields<" << FullTypeName;
+            for (std::string const& Field : FieldNames) {
+                Out << ", decltype(" << FullTypeName << "::" << Field << ")";
+            }
+            Out << "> { };\n";
+        }
+        Out << "#endif\n";
+    }
 
-    if (Mode == GenMode::ForwardDeclMode) {
-        GeneratedSource += Qualifier + "void Serialize(Serializer& Ser, char const* Name, " + FullTypeName + " const& Val);\n";
-        GeneratedSource += Qualifier + "void Deserialize(Deserializer& Ser, char const* Name, " + FullTypeName + "& Val);\n";
-        GeneratedSource += Qualifier + "void SerializeFields(Serializer& Ser, " + FullTypeName + " const& Val);\n";
-        GeneratedSource += Qualifier + "void DeserializeFields(Deserializer& Ser, " + FullTypeName + "& Val);\n";
+    if (Mode == GenMode::ForwardDeclMode || Mode == GenMode::InlineForwardDeclMode) {
+        WriteQualifier() << "void Serialize(Serializer& Ser, char const* Name, " << FullTypeName << " const& Val);\n";
+        WriteQualifier() << "void Deserialize(Deserializer& Ser, char const* Name, " << FullTypeName << "& Val);\n";
+        WriteQualifier() << "void SerializeFields(Serializer& Ser, " << FullTypeName << " const& Val);\n";
+        WriteQualifier() << "void DeserializeFields(Deserializer& Ser, " << FullTypeName << "& Val);\n";
     } else {
-        // Convert to a macro to avoid multiple definitions, replace :,<,>,, with _
-        std::string MacroName = FullTypeName;
-        std::replace(MacroName.begin(), MacroName.end(), ':', '_');
-        std::replace(MacroName.begin(), MacroName.end(), '<', '_');
-        std::replace(MacroName.begin(), MacroName.end(), '>', '_');
-        std::replace(MacroName.begin(), MacroName.end(), ',', '_');
-
-        GeneratedSource += "#ifndef " + MacroName + "_IMPL\n";
-        GeneratedSource += "#define " + MacroName + "_IMPL\n\n";
-
-        GeneratedSource += Qualifier + "void SerializeFields(Serializer& Ser, " + FullTypeName + " const& Val) {\n";
-        GeneratedSource += SerializeFieldsSource;
-        GeneratedSource += "}\n\n";
-
-        GeneratedSource += Qualifier + "void DeserializeFields(Deserializer& Ser, " + FullTypeName + "& Val) {\n";
-        GeneratedSource += DeserializeFieldsSource;
-        GeneratedSource += "}\n\n";
-
-        GeneratedSource += Qualifier + "void Serialize(Serializer& Ser, char const* Name, " + FullTypeName + " const& Val) {\n";
-        GeneratedSource += "    Ser.BeginObject(Name);\n";
-        GeneratedSource += "    SerializeFields(Ser, Val);\n";
-        GeneratedSource += "    Ser.EndObject();\n";
-        GeneratedSource += "}\n\n";
-
-        GeneratedSource += Qualifier + "void Deserialize(Deserializer& Ser, char const* Name, " + FullTypeName + "& Val) {\n";
-        GeneratedSource += "    Ser.BeginObject(Name);\n";
-        GeneratedSource += "    DeserializeFields(Ser, Val);\n";
-        GeneratedSource += "    Ser.EndObject();\n";
-        GeneratedSource += "}\n\n";
-
-        GeneratedSource += "#endif // " + MacroName + "\n";
+        // Guarded by a macro to avoid multiple definitions
+        std::string const& Macro = GetMacroName();
+
+        Out << "#ifndef " << Macro << "_IMPL\n";
+        Out << "#define " << Macro << "_IMPL\n\n";
+
+        WriteQualifier() << "void SerializeFields(Serializer& Ser, " << FullTypeName << " const& Val) {\n";
+        Out << SerializeFieldsSource;
+        Out << "}\n\n";
+
+        WriteQualifier() << "void DeserializeFields(Deserializer& Ser, " << FullTypeName << "& Val) {\n";
+        Out << DeserializeFieldsSource;
+        Out << "}\n\n";
+
+        WriteQualifier() << "void Serialize(Serializer& Ser, char const* Name, " << FullTypeName << " const& Val) {\n";
+        Out << "    Ser.BeginObject(Name);\n";
+        Out << "    SerializeFields(Ser, Val);\n";
+        Out << "    Ser.EndObject();\n";
+        Out << "}\n\n";
+
+        WriteQualifier() << "void Deserialize(Deserializer& Ser, char const* Name, " << FullTypeName << "& Val) {\n";
+        Out << "    Ser.BeginObject(Name);\n";
+        Out << "    DeserializeFields(Ser, Val);\n";
+        Out << "    Ser.EndObject();\n";
+        Out << "}\n\n";
+
+        Out << "#endif // " << Macro << "\n";
+    }
+}
+
+std::string GenDeserializeFieldsSource(std::vector<std::pair<std::string, std::string>> const& Fields) {
+    if (Fields.empty()) return "";
+
+    std::string Source = "    if (Ser.Format == SerdeFormat::Binary) {\n";
+    for (auto const& [Name, Value] : Fields) {
+        Source += "        Deserialize(Ser, \"" + Name + "\", " + Value + ");\n";
+    }
+    Source += "        return;\n";
+    Source += "    }\n\n";
+
+    // Field indices by key length, then by first character
+    std::map<size_t, std::map<char, std::vector<size_t>>> Buckets;
+    for (size_t i = 0; i < Fields.size(); ++i) {
+        Buckets[Fields[i].first.size()][Fields[i].first[0]].push_back(i);
     }
 
-    return GeneratedSource;
+    auto Dispatch = [&](size_t Index, std::string const& Indent) {
+        auto const& [Name, Value] = Fields[Index];
+        Source += Indent + "if (Key == \"" + Name + "\") {\n";
+        Source += Indent + "    DeserializeFields(Ser, " + Value + ");\n";
+        Source += Indent + "    Seen[" + std::to_string(Index) + "] = true;\n";
+        Source += Indent + "    return;\n";
+        Source += Indent + "}\n";
+    };
+
+    Source += "    bool Seen[" + std::to_string(Fields.size()) + "] = {};\n";
+    Source += "    Ser.ForEachMember([&](std::string_view Key) {\n";
+    Source += "        switch (Key.size()) {\n";
+    for (auto const& [Length, ByChar] : Buckets) {
+        Source += "        case " + std::to_string(Length) + ":\n";
+        if (ByChar.size() == 1) {
+            for (size_t Index : ByChar.begin()->second) Dispatch(Index, "            ");
+        } else {
+            Source += "            switch (Key[0]) {\n";
+            for (auto const& [First, Indices] : ByChar) {
+                Source += "            case '" + std::string(1, First) + "':\n";
+                for (size_t Index : Indices) Dispatch(Index, "                ");
+                Source += "                break;\n";
+            }
+            Source += "            }\n";
+        }
+        Source += "            break;\n";
+    }
+    Source += "        }\n";
+    Source += "    });\n\n";
+
+    Source += "    static char const* const Names[] = { ";
+    for (size_t i = 0; i < Fields.size(); ++i) {
+        Source += (i ? ", \"" : "\"") + Fields[i].first + "\"";
+    }
+    Source += " };\n";
+    Source += "    for (size_t i = 0; i < " + std::to_string(Fields.size()) + "; ++i) {\n";
+    Source += "        if (!Seen[i]) Ser.MissingField(Names[i]);\n";
+    Source += "    }\n";
+
+    return Source;
 }
 
 std::vector<std::string> ImplementationGeneratorSet::Combine(ImplementationGeneratorSet const& Other) {
@@ -96,107 +183,107 @@ std::vector<std::string> ImplementationGeneratorSet::Combine(ImplementationGener
     return Errors;
 }
 
-// TODO: Use an acceleration structure instead of just if statements
-std::string ImplementationGeneratorSet::GenDynamicReflectionImpl() const {
-    std::stringstream GeneratedFile;
-
-    GeneratedFile << "void DeserializeFields(Deserializer& Ser, SubclassOfBase& Val) {" << std::endl;
-    GeneratedFile << "    if (Ser.GetCurrentScope() == nullptr) {" << std::endl;
-    GeneratedFile << "        Val.Reset();" << std::endl;
-    GeneratedFile << "        return;" << std::endl;
-    GeneratedFile << "    }" << std::endl;
-    GeneratedFile << "    std::string const Type = Ser.AtChecked(\"Type\");" << std::endl;
+void ImplementationGeneratorSet::GenDynamicReflectionImpl(CodeWriter& Out) const {
+    // Hashed into an open addressing table at compile time, see MakeSubclassTable
+    Out << "static constexpr auto SubclassTable = MakeSubclassTable(std::array<SubclassTableEntry, " << std::to_string(NonTemplateTypes.size()) << "> {{\n";
     for (std::string const& TypeName : NonTemplateTypes) {
-        GeneratedFile << "    if (Type == \"" << TypeName << "\") {" << std::endl;
-        GeneratedFile << "        Ser.BeginObject(\"Value\");" << std::endl;
-        GeneratedFile << "        " << TypeName << " Temp;" << std::endl;
-        GeneratedFile << "        DeserializeFields(Ser, Temp);" << std::endl;
-        GeneratedFile << "        Val = SubclassOf<" << TypeName << ">(Temp);" << std::endl;
-        GeneratedFile << "        Ser.EndObject();" << std::endl;
-        GeneratedFile << "        return;" << std::endl;
-        GeneratedFile << "    }" << std::endl;
+        Out << "    { 0, \"" << TypeName << "\", &typeid(" << TypeName << "), &SerializeSubclassFields<" << TypeName << ">, &DeserializeSubclassFields<" << TypeName << "> },\n";
     }
-    GeneratedFile << "    throw std::runtime_error(\"Unknown type \" + Type);" << std::endl;
-    GeneratedFile << "}" << std::endl << std::endl;
+    Out << "}});\n\n";
+
+    Out << "void DeserializeFields(Deserializer& Ser, SubclassOfBase& Val) {\n";
+    Out << "    if (!Ser.ReadHasValue()) {\n";
+    Out << "        Val.Reset();\n";
+    Out << "        return;\n";
+    Out << "    }\n";
+    Out << "    std::string Type;\n";
+    Out << "    Deserialize(Ser, \"Type\", Type);\n";
+    Out << "    SubclassTableEntry const* Found = FindSubclass(SubclassTable, Type);\n";
+    Out << "    if (!Found) throw std::runtime_error(\"Unknown type \" + Type);\n";
+    Out << "    Ser.BeginObject(\"Value\");\n";
+    Out << "    Found->DeserializeFields(Ser, Val);\n";
+    Out << "    Ser.EndObject();\n";
+    Out << "}\n\n";
     
-    GeneratedFile << "void Deserialize(Deserializer& Ser, char const* Name, SubclassOfBase& Val) {" << std::endl;
-    GeneratedFile << "    Ser.BeginObject(Name);" << std::endl;
-    GeneratedFile << "    DeserializeFields(Ser, Val);" << std::endl;
-    GeneratedFile << "    Ser.EndObject();" << std::endl;
-    GeneratedFile << "}" << std::endl << std::endl;
-
-    GeneratedFile << "void SerializeFields(Serializer& Ser, SubclassOfBase const& Val) {" << std::endl;
-    GeneratedFile << "    if (!Val.GetAny().has_value()) {" << std::endl;
-    GeneratedFile << "        Ser.GetCurrentScope() = nullptr;" << std::endl;
-    GeneratedFile << "        return;" << std::endl;
-    GeneratedFile << "    }" << std::endl;
-    for (std::string const& TypeName : NonTemplateTypes) {
-        GeneratedFile << "    if (Val.GetAny().type() == typeid(" << TypeName << ")) {" << std::endl;
-        GeneratedFile << "        Ser.AtChecked(\"Type\") = \"" << TypeName << "\";" << std::endl;
-        GeneratedFile << "        Ser.BeginObject(\"Value\");" << std::endl;
-        GeneratedFile << "        SerializeFields(Ser, std::any_cast<" << TypeName << ">(Val.GetAny()));" << std::endl;
-        GeneratedFile << "        Ser.EndObject();" << std::endl;
-        GeneratedFile << "        return;" << std::endl;
-        GeneratedFile << "    }" << std::endl;
-    }
-    GeneratedFile << "    throw std::runtime_error(\"Unsupported type \" + std::string(Val.GetAny().type().name()));" << std::endl;
-    GeneratedFile << "}" << std::endl << std::endl;
+    Out << "void Deserialize(Deserializer& Ser, char const* Name, SubclassOfBase& Val) {\n";
+    Out << "    Ser.BeginObject(Name);\n";
+    Out << "    DeserializeFields(Ser, Val);\n";
+    Out << "    Ser.EndObject();\n";
+    Out << "}\n\n";
+
+    Out << "void SerializeFields(Serializer& Ser, SubclassOfBase const& Val) {\n";
+    Out << "    Ser.WriteHasValue(Val.GetAny().has_value());\n";
+    Out << "    if (!Val.GetAny().has_value()) return;\n";
+    Out << "    static std::unordered_map<std::type_index, SubclassTableEntry const*> const ByType = IndexSubclassTable(SubclassTable);\n";
+    Out << "    auto const Found = ByType.find(std::type_index(Val.GetAny().type()));\n";
+    Out << "    if (Found == ByType.end()) throw std::runtime_error(\"Unsupported type \" + std::string(Val.GetAny().type().name()));\n";
+    Out << "    Serialize(Ser, \"Type\", std::string(Found->second->Name));\n";
+    Out << "    Ser.BeginObject(\"Value\");\n";
+    Out << "    Found->second->SerializeFields(Ser, Val.GetAny());\n";
+    Out << "    Ser.EndObject();\n";
+    Out << "}\n\n";
     
-    GeneratedFile << "void Serialize(Serializer& Ser, char const* Name, SubclassOfBase const& Val) {" << std::endl;
-    GeneratedFile << "    Ser.BeginObject(Name);" << std::endl;
-    GeneratedFile << "    SerializeFields(Ser, Val);" << std::endl;
-    GeneratedFile << "    Ser.EndObject();" << std::endl;
-    GeneratedFile << "}" << std::endl << std::endl;
-
-    return GeneratedFile.str();
-}
-
-void SaveCachedGenerator(std::filesystem::path const& FilePath, ImplementationGeneratorSet const& Generator) {
-    nlohmann::json J;
-
-    nlohmann::json& GeneratorsJSON = J["Generators"];
-    for (auto kvp : Generator.Generators) {
-        GeneratorsJSON[kvp.first]["Templates"] = kvp.second.Templates;
-        GeneratorsJSON[kvp.first]["FullTypeName"] = kvp.second.FullTypeName;
-        GeneratorsJSON[kvp.first]["SerializeFieldsSource"] = kvp.second.SerializeFieldsSource;
-        GeneratorsJSON[kvp.first]["DeserializeFieldsSource"] = kvp.second.DeserializeFieldsSource;
-    }
-
-    J["NonTemplateTypes"] = Generator.NonTemplateTypes;
-
-    std::filesystem::create_directory(".AutoReflect");
-
-    std::ofstream Serialized(std::filesystem::path(".AutoReflect") / PathToString(FilePath), std::ios::ate);
-    Serialized << J.dump(4);
+    Out << "void Serialize(Serializer& Ser, char const* Name, SubclassOfBase const& Val) {\n";
+    Out << "    Ser.BeginObject(Name);\n";
+    Out << "    SerializeFields(Ser, Val);\n";
+    Out << "    Ser.EndObject();\n";
+    Out << "}\n\n";
 }
 
-std::optional<ImplementationGeneratorSet> GetCachedGenerator(std::filesystem::path const& FilePath) {
-    const std::filesystem::path CachedPath = std::filesystem::path(".AutoReflect") / PathToString(FilePath);
-
-    if (!std::filesystem::exists(CachedPath))
-        return std::nullopt;
-
-    std::ifstream Cached(CachedPath);
-    std::string CachedStr((std::istreambuf_iterator<char>(Cached)), std::istreambuf_iterator<char>());
-
-    ImplementationGeneratorSet Res;
-
-    nlohmann::json J = nlohmann::json::parse(CachedStr);
-    
-    for (const auto& [key, value] : J["Generators"].items()) {
-        ImplementationGenerator IG;
-        IG.Templates = value["Templates"].get<std::string>();
-        IG.FullTypeName = value["FullTypeName"].get<std::string>();
-        IG.SerializeFieldsSource = value["SerializeFieldsSource"].get<std::string>();
-        IG.DeserializeFieldsSource = value["DeserializeFieldsSource"].get<std::string>();
-
-        Res.Generators[key] = IG;
+void ImplementationGeneratorSet::GenRegistryReflectionImpl(CodeWriter& Out) const {
+    // Every generated file carries the lookups, the first one included defines them
+    Out << "#ifndef SUBCLASS_REGISTRY_IMPLS\n";
+    Out << "#define SUBCLASS_REGISTRY_IMPLS\n\n";
+
+    Out << "inline void DeserializeFields(Deserializer& Ser, SubclassOfBase& Val) {\n";
+    Out << "    if (!Ser.ReadHasValue()) {\n";
+    Out << "        Val.Reset();\n";
+    Out << "        return;\n";
+    Out << "    }\n";
+    Out << "    std::string Type;\n";
+    Out << "    Deserialize(Ser, \"Type\", Type);\n";
+    Out << "    SubclassRegistry::Entry const* Found = SubclassRegistry::Get().Find(Type);\n";
+    Out << "    if (!Found) throw std::runtime_error(\"Unknown type \" + Type);\n";
+    Out << "    Ser.BeginObject(\"Value\");\n";
+    Out << "    Found->DeserializeFields(Ser, Val);\n";
+    Out << "    Ser.EndObject();\n";
+    Out << "}\n\n";
+
+    Out << "inline void Deserialize(Deserializer& Ser, char const* Name, SubclassOfBase& Val) {\n";
+    Out << "    Ser.BeginObject(Name);\n";
+    Out << "    DeserializeFields(Ser, Val);\n";
+    Out << "    Ser.EndObject();\n";
+    Out << "}\n\n";
+
+    Out << "inline void SerializeFields(Serializer& Ser, SubclassOfBase const& Val) {\n";
+    Out << "    Ser.WriteHasValue(Val.GetAny().has_value());\n";
+    Out << "    if (!Val.GetAny().has_value()) return;\n";
+    Out << "    SubclassRegistry::Entry const* Found = SubclassRegistry::Get().Find(Val.GetAny().type());\n";
+    Out << "    if (!Found) throw std::runtime_error(\"Unsupported type \" + std::string(Val.GetAny().type().name()));\n";
+    Out << "    Serialize(Ser, \"Type\", Found->Name);\n";
+    Out << "    Ser.BeginObject(\"Value\");\n";
+    Out << "    Found->SerializeFields(Ser, Val.GetAny());\n";
+    Out << "    Ser.EndObject();\n";
+    Out << "}\n\n";
+
+    Out << "inline void Serialize(Serializer& Ser, char const* Name, SubclassOfBase const& Val) {\n";
+    Out << "    Ser.BeginObject(Name);\n";
+    Out << "    SerializeFields(Ser, Val);\n";
+    Out << "    Ser.EndObject();\n";
+    Out << "}\n\n";
+
+    Out << "#endif // SUBCLASS_REGISTRY_IMPLS\n\n";
+
+    // Inline variables are initialized once per program however many files include this one
+    for (std::string const& TypeName : NonTemplateTypes) {
+        auto const Found = Generators.find(TypeName);
+        if (Found == Generators.end()) continue;
+        std::string const& Macro = Found->second.GetMacroName();
+        Out << "#ifndef " << Macro << "_REGISTRY\n";
+        Out << "#define " << Macro << "_REGISTRY\n";
+        Out << "inline bool const " << Macro << "_REGISTERED = SubclassRegistry::Get().Register<" << TypeName << ">(\"" << TypeName << "\");\n";
+        Out << "#endif\n";
     }
-
-    auto NonTempalteTypesVec = J["NonTemplateTypes"].get<std::vector<std::string>>();
-    Res.NonTemplateTypes = std::set<std::string>(NonTempalteTypesVec.begin(), NonTempalteTypesVec.end());
-    
-    return Res;
 }
 
 std::string Template::Generate(bool IsOuter) const {
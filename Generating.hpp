@@ -10,13 +10,25 @@ struct ImplementationGenerator {
     std::string FullTypeName;
     std::string SerializeFieldsSource;
     std::string DeserializeFieldsSource;
+    std::vector<std::string> FieldNames;
 
     bool operator==(ImplementationGenerator const& Other) const;
     bool operator!=(ImplementationGenerator const& Other) const;
 
-    std::string Generate(GenMode Mode) const;
+    void Generate(CodeWriter& Out, GenMode Mode) const;
+
+    // FullTypeName with :,<,>,, replaced by _, computed on first use
+    std::string const& GetMacroName() const;
+
+    // Cache of GetMacroName, left last so the generator stays an aggregate
+    mutable std::string MacroName;
 };
 
+// Body of DeserializeFields from (field name, lvalue) pairs in declaration order
+// The binary format reads them in that order, the JSON formats make one pass over the object's members
+// and switch on each key's length and first character, so members can come in any order
+std::string GenDeserializeFieldsSource(std::vector<std::pair<std::string, std::string>> const& Fields);
+
 struct ImplementationGeneratorSet {
     std::map<std::string, ImplementationGenerator> Generators;
     std::set<std::string> NonTemplateTypes;
@@ -25,11 +37,11 @@ struct ImplementationGeneratorSet {
     // Mismatched generators can allow generation to continue but should ultimately cause a failure
     std::vector<std::string> Combine(ImplementationGeneratorSet const& Other);
 
-    std::string GenDynamicReflectionImpl() const;
-};
+    void GenDynamicReflectionImpl(CodeWriter& Out) const;
 
-void SaveCachedGenerator(std::filesystem::path const& Filepath, ImplementationGeneratorSet const& Generator);
-std::optional<ImplementationGeneratorSet> GetCachedGenerator(std::filesystem::path const& FilePath);
+    // Inline mode alternative to GenDynamicReflectionImpl, the non-template types add themselves to SubclassRegistry
+    void GenRegistryReflectionImpl(CodeWriter& Out) const;
+};
 
 struct KindOrType {
     std::string KindOrTypeName;
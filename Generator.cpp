@@ -6,7 +6,6 @@
 #include <optional>
 #include <variant>
 
-#include <regex>
 #include <fstream>
 #include <iostream>
 #include <filesystem>
@@ -17,12 +16,27 @@
 #include <thread>
 
 #include "Parsing.hpp"
+#include "LibClangFrontend.hpp"
 #include "Generating.hpp"
+#include "GeneratorCache.hpp"
+#include "Trace.hpp"
+#include "DependencyGraph.hpp"
+#include "Watcher.hpp"
 
 #define GeneratedSuffix ".gen.inl"
 
-const std::regex ClassRegex("class ([a-zA-Z0-9_]+) definition");
-const std::regex FieldRegex("([a-zA-Z0-9_]+) '([a-zA-Z0-9_:<>, \\*\\&\\[\\]]+)'");
+// Defined while clang parses inputs, generated files then only expose the contents of null_generated.h
+#define GeneratingMacro "AUTOREFLECT_GENERATING"
+
+std::string ReadResource(std::string const& Name) {
+    std::ifstream File(std::filesystem::path(AR_RESOURCES_DIR) / Name);
+    return std::string((std::istreambuf_iterator<char>(File)), std::istreambuf_iterator<char>());
+}
+
+bool IsGeneratedFile(std::string const& Path) {
+    std::string_view const Suffix = GeneratedSuffix;
+    return Path.size() >= Suffix.size() && Path.compare(Path.size() - Suffix.size(), Suffix.size(), Suffix) == 0;
+}
 
 class GeneratorContext {
 private:
@@ -31,9 +45,14 @@ private:
     std::vector<std::string> Errors;
     std::map<std::string, std::string> EnumTypeMaps;
     int NumAutoReflectNamespaces = 0;
+
+    // Released as soon as generation finishes
+    ASTTree AST;
 public:
     // Output Variables:
     ImplementationGeneratorSet Generators;
+    std::vector<std::string> Dependencies;
+    bool Parsed = false;
 
     std::string GetFullyQualifiedName() const {
         if (TemplateStack.empty() && NameStack.empty()) return "";
@@ -64,33 +83,23 @@ public:
         std::string LocalEnumName;
         std::string UnderlyingType;
     };
-    std::optional<EnumDefinition> GetAsEnumDefinition(ASTPtr Node) {
-        if (Node->Tag != TagType::EnumDecl) return std::nullopt;
-        if (Node->Line.back() != '\'') return std::nullopt;
+    std::optional<EnumDefinition> GetAsEnumDefinition(ASTNode const& Node) {
+        if (Node.Tag != TagType::EnumDecl) return std::nullopt;
 
-        auto ClassIndex = Node->Line.find("class ");
-        if (ClassIndex == std::string::npos) return std::nullopt;
+        std::string_view Name, Underlying;
+        if (!ScanEnum(Node.Line, Name, Underlying)) return std::nullopt;
 
-        std::string Line = Node->Line.substr(ClassIndex + 6);
-        auto NextSpaceIndex = Line.find(' ');
-        if (NextSpaceIndex == std::string::npos) return std::nullopt;
-
-        Line.pop_back(); // Remove the '
-        auto LastSpaceIndex = Line.find_last_of('\'');
-        if (LastSpaceIndex == std::string::npos) return std::nullopt;
-
-        return EnumDefinition { Line.substr(0, NextSpaceIndex), Line.substr(LastSpaceIndex + 1) };
+        return EnumDefinition { std::string(Name), std::string(Underlying) };
     }
 
     struct ClassDefinition {
         std::string LocalClassName;
     };
-    std::optional<ClassDefinition> GetAsClassDefinition(ASTPtr Node) {
-        if (Node->Tag == TagType::CXXRecordDecl && (Node->Line.find("implicit") == std::string::npos)) {
+    std::optional<ClassDefinition> GetAsClassDefinition(ASTNode const& Node) {
+        if (Node.Tag == TagType::CXXRecordDecl && (Node.Line.find("implicit") == std::string::npos)) {
             
-            std::smatch ClassMatch;
-            if (std::regex_search(Node->Line, ClassMatch, ClassRegex)) {
-                return ClassDefinition{ ClassMatch[1] };
+            if (std::optional<std::string_view> Name = ScanClassDefinition(Node.Line)) {
+                return ClassDefinition{ std::string(*Name) };
             }
         }
 
@@ -100,15 +109,15 @@ public:
     struct NamespaceDefinition {
         std::string LocalNamespaceName;
     };
-    std::optional<NamespaceDefinition> GetAsNamespaceDefinition(ASTPtr Node) {
-        if (Node->Tag == TagType::NamespaceDecl) {
+    std::optional<NamespaceDefinition> GetAsNamespaceDefinition(ASTNode const& Node) {
+        if (Node.Tag == TagType::NamespaceDecl) {
             // The namespace name is the last word in the line
             size_t i;
-            for (i = Node->Line.size() - 1; i > 0; --i) {
-                if (Node->Line[i] == ' ') break;
+            for (i = Node.Line.size() - 1; i > 0; --i) {
+                if (Node.Line[i] == ' ') break;
             }
 
-            return NamespaceDefinition { Node->Line.substr(i + 1) };
+            return NamespaceDefinition { std::string(Node.Line.substr(i + 1)) };
         }
 
         return std::nullopt;
@@ -117,35 +126,33 @@ public:
     struct TemplateDefinition {
         Template T;
     };
-    std::optional<TemplateDefinition> GetAsTemplateDefinition(ASTPtr Node, TemplatePtr ParentTemplate = nullptr) {
+    std::optional<TemplateDefinition> GetAsTemplateDefinition(ASTNode const& Node, TemplatePtr ParentTemplate = nullptr) {
         if (
-            Node->Tag == TagType::ClassTemplateDecl ||
-            Node->Tag == TagType::TemplateTypeParmDecl ||
-            Node->Tag == TagType::NonTypeTemplateParmDecl ||
-            Node->Tag == TagType::TemplateTemplateParmDecl
+            Node.Tag == TagType::ClassTemplateDecl ||
+            Node.Tag == TagType::TemplateTypeParmDecl ||
+            Node.Tag == TagType::NonTypeTemplateParmDecl ||
+            Node.Tag == TagType::TemplateTemplateParmDecl
         ) {
             TemplatePtr T = ParentTemplate ? ParentTemplate : std::make_shared<Template>();
 
-            for (size_t i = 0; i < Node->Children.size(); ++i) {
-                auto Child = Node->Children[i];
+            for (ASTNode const& Child : AST.Children(Node)) {
                 if (
-                    Child->Tag == TagType::TemplateTypeParmDecl ||
-                    Child->Tag == TagType::NonTypeTemplateParmDecl ||
-                    Child->Tag == TagType::TemplateTemplateParmDecl
+                    Child.Tag == TagType::TemplateTypeParmDecl ||
+                    Child.Tag == TagType::NonTypeTemplateParmDecl ||
+                    Child.Tag == TagType::TemplateTemplateParmDecl
                 ) {
-                    std::string TypeName;
-                    std::string VarName;
-                    bool HasType;
+                    std::string_view TypeName;
+                    std::string_view VarName;
                     
-                    if (GetTemplateParams(Child->Line, TypeName, VarName, HasType)) {
+                    if (GetTemplateParams(Child.Line, TypeName, VarName)) {
                         TemplateParam TParam;
-                        if (Child->Tag == TagType::TemplateTemplateParmDecl) {
+                        if (Child.Tag == TagType::TemplateTemplateParmDecl) {
                             TemplatePtr TemplateChild = std::make_shared<Template>();
                             GetAsTemplateDefinition(Child, TemplateChild);
                             TParam = TemplateChild;
-                            TemplateChild->Name = VarName;
+                            TemplateChild->Name = std::string(VarName);
                         } else {
-                            TParam = KindOrType { TypeName, VarName };
+                            TParam = KindOrType { std::string(TypeName), std::string(VarName) };
                         }
                         T->Params.push_back(TParam);
                     }
@@ -162,23 +169,23 @@ public:
         std::string TypeName;
         std::string VarName;
     };
-    std::optional<FieldDefinition> GetAsField(ASTPtr Node) {
+    std::optional<FieldDefinition> GetAsField(ASTNode const& Node) {
         // Sample line:
         // 0x13c10cb60 <line:16:9, col:13> col:13 h 'int'
-        if (Node->Tag != TagType::FieldDecl) {
+        if (Node.Tag != TagType::FieldDecl) {
             return std::nullopt;
         }
 
         // Allow :,<,>, for qualified names and templates
-        std::smatch FieldMatch;
-        if (std::regex_search(Node->Line, FieldMatch, FieldRegex)) {
-            return FieldDefinition{ FieldMatch[2], FieldMatch[1] };
+        std::string_view Name, Type;
+        if (ScanField(Node.Line, Name, Type)) {
+            return FieldDefinition{ std::string(Type), std::string(Name) };
         } else {
             return std::nullopt;
         }
     }
 
-    void GenerateClass(ASTPtr Node, int Indent, bool Generating) {
+    void GenerateClass(ASTNode const& Node, int Indent, bool Generating) {
         auto ClassDef = GetAsClassDefinition(Node);
         if (!ClassDef) {
             throw std::runtime_error("Could not find class definition");
@@ -189,12 +196,12 @@ public:
         Template Flattened = GetFlattenedTemplates();
         std::string Templates = Flattened.Generate();
         std::string FullyQualified = GetFullyQualifiedName();
-        std::string SerializeFieldsSource, DeserializeFieldsSource;
+        std::string SerializeFieldsSource;
+        std::vector<std::pair<std::string, std::string>> DeserializeFields;
+        std::vector<std::string> FieldNames;
 
         bool FoundAutoReflect = false;
-        for (size_t i = 0; i < Node->Children.size(); ++i) {
-            auto Child = Node->Children[i];
-            
+        for (ASTNode const& Child : AST.Children(Node)) {
             if (std::optional<FieldDefinition> FieldDef = GetAsField(Child)) {
                 FieldDefinition FD = *FieldDef;
 
@@ -209,8 +216,9 @@ public:
                 }
 
                 SerializeFieldsSource += "    Serialize(Ser, \"" + FD.VarName + "\", " + SerializeName + ");\n";
-                DeserializeFieldsSource += "    Deserialize(Ser, \"" + FD.VarName + "\", " + DeserializeName + ");\n";
-            } else if ((Child->Tag == TagType::Private || Child->Tag == TagType::Public) && Child->Line == "'AutoReflect'") {
+                DeserializeFields.emplace_back(FD.VarName, DeserializeName);
+                FieldNames.push_back(FD.VarName);
+            } else if ((Child.Tag == TagType::Private || Child.Tag == TagType::Public) && Child.Line == "'AutoReflect'") {
                 FoundAutoReflect = true;
             }
         }
@@ -235,28 +243,26 @@ public:
                 Generators.NonTemplateTypes.insert(FullyQualified);
             }
 
-            Generators.Generators[FullTypeName] = ImplementationGenerator { Templates, FullTypeName, SerializeFieldsSource, DeserializeFieldsSource };
+            Generators.Generators[FullTypeName] = ImplementationGenerator { Templates, FullTypeName, SerializeFieldsSource, GenDeserializeFieldsSource(DeserializeFields), FieldNames };
         }
     }
 
-    void GenerateScope(ASTPtr Node, int Indent, bool Generating) {
+    void GenerateScope(ASTNode const& Node, int Indent, bool Generating) {
         // Assert if tag isn't a scope
-        if (Node->Tag != TagType::TranslationUnitDecl && Node->Tag != TagType::NamespaceDecl && Node->Tag != TagType::ClassTemplateDecl && Node->Tag != TagType::CXXRecordDecl) {
-            throw std::runtime_error("Tag is not a scope, is " + std::to_string(static_cast<int>(Node->Tag)));
+        if (Node.Tag != TagType::TranslationUnitDecl && Node.Tag != TagType::NamespaceDecl && Node.Tag != TagType::ClassTemplateDecl && Node.Tag != TagType::CXXRecordDecl) {
+            throw std::runtime_error("Tag is not a scope, is " + std::to_string(static_cast<int>(Node.Tag)));
         }
 
-        for (size_t i = 0; i < Node->Children.size(); ++i) {
-            auto Child = Node->Children[i];
-            
+        for (ASTNode const& Child : AST.Children(Node)) {
             if (std::optional<TemplateDefinition> TemplateDef = GetAsTemplateDefinition(Child)) {
                 TemplateStack.push_back(TemplateDef->T);
-                ASTPtr ClassNode = Node->Children.back();
+                ASTNode const& ClassNode = AST[Node.LastChild];
                 if (GetAsClassDefinition(ClassNode)) {
                     GenerateClass(ClassNode, Indent, Generating);
                 }
                 TemplateStack.pop_back();
             } else if (std::optional<ClassDefinition> ClassDef = GetAsClassDefinition(Child)) {
-                if (Child->Line.find("implicit") != std::string::npos) {
+                if (Child.Line.find("implicit") != std::string::npos) {
                     continue;
                 }
                 GenerateClass(Child, Indent + 1, Generating);
@@ -278,18 +284,38 @@ public:
         }
     }
 
-    GeneratorContext(std::filesystem::path const& Path, std::vector<std::filesystem::path> const& IncludePaths, bool Silent) {
+    GeneratorContext(std::filesystem::path const& Path, std::vector<std::filesystem::path> const& IncludePaths, std::filesystem::path const& Pch, std::set<std::string> const& ProjectFiles, bool UseLibClang, bool Silent) {
+        const std::filesystem::path DepFile = std::filesystem::path(CacheDirectory) / (PathToString(Path) + ".d");
+        std::filesystem::create_directory(CacheDirectory);
+
         CallOnDtor OnDtor([&]() {
             TemplateStack.clear();
             NameStack.clear();
             Errors.clear();
             NumAutoReflectNamespaces = 0;
+            AST = ASTTree();
         });
 
-        ASTPtr Root = LoadASTNodes(Path, IncludePaths, Silent);
+        {
+            TraceScope Scope("LoadASTNodes", Path);
+            AST = UseLibClang ? LoadASTNodesLibClang(Path, IncludePaths, Pch, DepFile, ProjectFiles, Silent) : LoadASTNodes(Path, IncludePaths, Pch, DepFile, ProjectFiles, Silent);
+            Scope.AddArg("Nodes", static_cast<int64_t>(AST.Size()));
+            TraceRecorder::AddCounter("ASTNodes", static_cast<int64_t>(AST.Size()));
+        }
+
+        // The dependency file is written by the same clang run that produced the AST
+        if (std::filesystem::exists(DepFile)) {
+            TraceScope Scope("GetAllHeaders", Path);
+            Dependencies = GetAllHeaders(DepFile);
+            std::filesystem::remove(DepFile);
+        }
+
+        if (AST.Empty()) return;
+        Parsed = true;
 
         try {
-            GenerateScope(Root, 0, true);
+            TraceScope Scope("GenerateScope", Path);
+            GenerateScope(AST.GetRoot(), 0, true);
         } catch (std::runtime_error const& Er) {
             std::cerr << "Failed during generation (internal error): " << Er.what() << std::endl;
             return;
@@ -306,12 +332,43 @@ struct InputParams {
     std::vector<std::filesystem::path> FilesToParse;
     std::filesystem::path MainImpl, MainImplOutput;
     bool Silent = false;
+    bool UseLibClang = false;
+    bool UsePch = true;
+
+    // Type implementations are split across this many .gen.cpp files next to the main impl, 0 keeps them in the main impl
+    size_t Shards = 0;
+
+    // Chrome trace event output, see Trace.hpp
+    std::filesystem::path TracePath;
+    size_t Jobs = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+
+    // Resident mode, see Watcher.hpp
+    bool Watch = false;
+    std::filesystem::path SocketPath, ConnectSocket;
 
     InputParams(int argc, char** argv) {
         for (int i = 1; i < argc; ++i) {
             std::string Arg = argv[i];
             if (Arg == "-S") {
                 Silent = true;
+            } else if (Arg == "-j" && i + 1 < argc) {
+                Jobs = std::max(std::stoi(argv[++i]), 1);
+            } else if (Arg.rfind("-j", 0) == 0 && Arg.size() > 2) {
+                Jobs = std::max(std::stoi(Arg.substr(2)), 1);
+            } else if (Arg == "--libclang") {
+                UseLibClang = true;
+            } else if (Arg == "--no-pch") {
+                UsePch = false;
+            } else if (Arg == "--trace" && i + 1 < argc) {
+                TracePath = argv[++i];
+            } else if (Arg == "--shards" && i + 1 < argc) {
+                Shards = std::max(std::stoi(argv[++i]), 0);
+            } else if (Arg == "--watch") {
+                Watch = true;
+            } else if (Arg == "--socket" && i + 1 < argc) {
+                SocketPath = argv[++i];
+            } else if (Arg == "--connect" && i + 1 < argc) {
+                ConnectSocket = argv[++i];
             } else if (Arg == "-M") {
                 MainImpl = (argc > i + 1) ? argv[++i] : "";
                 MainImplOutput = MainImpl;
@@ -338,139 +395,478 @@ struct InputParams {
     }
 };
 
-int main(int argc, char** argv) {
-    InputParams Params(argc, argv);
+// Everything that survives between generation passes, so a resident watcher only redoes stale work
+class GenerationSession {
+private:
+    InputParams const& Params;
+
+    // Does not generate a main file, just tries to place everything in inline functions
+    // Does not support SubclassOf reflection when using this mode
+    const bool InlineMode;
+
+    WorkerPool Pool;
 
-    ImplementationGeneratorSet GlobalGenerators;
+    const std::filesystem::path TimingsPath = std::filesystem::path(CacheDirectory) / "Timings.json";
+    FileTimings Timings;
 
+    const std::filesystem::path GraphPath = std::filesystem::path(CacheDirectory) / "DependencyGraph.json";
+    DependencyGraph Graph;
+
+    const std::string NullGenerated = ReadResource("null_generated.h");
+    const std::string BaseTemplateImpls = ReadResource("BaseTemplateImpls.txt");
+    const std::string BaseImpls = ReadResource("BaseImpls.txt");
+
+    // Generators of every input, kept once loaded so later passes don't need the cache
+    std::map<std::filesystem::path, ImplementationGeneratorSet> FileGenerators;
     std::mutex SharedContextMut;
 
-    // Does not generate a main file, just tries to place everything in inline functions
-    // Does not support SubclassOf reflection when using this mode
-    const bool InlineMode = Params.MainImpl.empty();
+    // Kept between passes, so its buffer is only allocated once
+    CodeWriter MainImplFile;
 
-    // TODO: Support this feature
-    if (InlineMode) {
-        std::cerr << "Inline mode is not supported yet, you need to specify a main file with -M" << std::endl;
-        return 1;
+    GeneratorCache Cache { std::filesystem::path(CacheDirectory) / "Generators.bin" };
+
+    // Graph keys are spelled however clang printed them, the watcher reports canonical paths
+    std::map<std::string, std::string> CanonicalPaths;
+
+    // Canonical paths of the inputs, declarations from any other file are never materialized
+    std::set<std::string> ProjectFiles;
+
+    // AutoReflectDecls.hpp, with nlohmann/json and glm, precompiled once and passed to every clang run
+    // Checked at most once per pass, and only when something actually has to be parsed
+    std::filesystem::path Pch;
+    bool PchChecked = false;
+    std::mutex PchMutex;
+
+    // Returns an empty path if precompiled headers are disabled or the header failed to build
+    std::filesystem::path GetPch() {
+        if (!Params.UsePch) return std::filesystem::path();
+
+        std::unique_lock<std::mutex> Lock = LockTraced(PchMutex);
+        if (PchChecked) return Pch;
+        PchChecked = true;
+        Pch.clear();
+
+        std::filesystem::create_directory(CacheDirectory);
+        const std::filesystem::path Prefix = std::filesystem::path(CacheDirectory) / "Prefix.hpp";
+        WriteIfChanged(Prefix, "#include <AutoReflectDecls.hpp>\n");
+
+        // The header is only valid for the exact options it was built with, so they are part of its name
+        std::string const Options = CommandToString(GetClangCommonArgs(Params.IncludePaths));
+        char Key[17];
+        snprintf(Key, sizeof(Key), "%016llx", static_cast<unsigned long long>(HashBytes(Options.data(), Options.size())));
+        const std::filesystem::path PchPath = std::filesystem::path(CacheDirectory) / ("Prefix." + std::string(Key) + ".pch");
+
+        if (std::filesystem::exists(PchPath) && !Graph.FindChangedDependency(PchPath)) {
+            Pch = PchPath;
+            return Pch;
+        }
+
+        // Headers built with other options are never going to be used again
+        for (auto const& Entry : std::filesystem::directory_iterator(CacheDirectory)) {
+            std::string const Name = Entry.path().filename().string();
+            if (Name.rfind("Prefix.", 0) == 0 && Entry.path().extension() == ".pch") std::filesystem::remove(Entry.path());
+        }
+
+        TraceScope Scope("BuildPch", Prefix);
+        const std::filesystem::path DepFile = PchPath.string() + ".d";
+        if (!BuildPch(Prefix, Params.IncludePaths, PchPath, DepFile, Params.Silent)) {
+            std::cerr << "Could not build the precompiled header, parsing without it" << std::endl;
+            return Pch;
+        }
+
+        Graph.Update(PchPath, GetAllHeaders(DepFile));
+        std::filesystem::remove(DepFile);
+
+        Pch = PchPath;
+        return Pch;
     }
-    
-    std::atomic_bool GlobalAnyNewer = false;
 
-    ParallelFor([&Params, &GlobalGenerators, &SharedContextMut, InlineMode, &GlobalAnyNewer](std::filesystem::path const& Path) {
-        int NumErrors = 0;
+    // Runs clang on a file and records everything it depends on
+    ImplementationGeneratorSet GenerateFile(std::filesystem::path const& Path) {
+        TraceScope Scope("GenerateFile", Path);
+        std::filesystem::path const Pch = GetPch();
+
+        std::optional<GeneratorContext> Context;
+        Context.emplace(Path, Params.IncludePaths, Pch, ProjectFiles, Params.UseLibClang, Params.Silent);
+
+        // Clang refuses a precompiled header it considers out of date, and then dumps nothing
+        if (!Context->Parsed && !Pch.empty()) {
+            if (!Params.Silent) Log(Path, "Parsing with the precompiled header failed, retrying without it");
+            Context.emplace(Path, Params.IncludePaths, std::filesystem::path(), ProjectFiles, Params.UseLibClang, Params.Silent);
+        }
+        if (!Context->Parsed) {
+            std::cerr << "Failed during generation: clang produced no AST for " << Path << std::endl;
+        }
+
+        {
+            TraceScope PutScope("CachePut", Path);
+            Cache.Put(Path, Context->Generators);
+        }
+
+        // Generated files only contain null stubs while parsing, so their contents never matter
+        // The precompiled header has its own entry in the graph, it is rebuilt whenever its inputs change
+        std::vector<std::string> Dependencies;
+        for (auto const& Dep : Context->Dependencies) {
+            if (!IsGeneratedFile(Dep) && Dep != Pch.string()) Dependencies.push_back(Dep);
+        }
+        Graph.Update(Path, Dependencies);
+
+        return std::move(Context->Generators);
+    }
+
+    // Regenerates the file if any of its dependencies changed, returns true if it did
+    bool ProcessFile(std::filesystem::path const& Path) {
+        TraceScope Scope("ProcessFile", Path);
+        auto const StartTime = std::chrono::steady_clock::now();
 
         std::filesystem::path OutputPath = Path;
         OutputPath += GeneratedSuffix;
 
-        if (OutputPath == Params.MainImplOutput) return;
+        if (OutputPath == Params.MainImplOutput) return false;
 
-        // Get write date of output file
-        auto const OutputWriteTime = std::filesystem::exists(OutputPath) ? std::filesystem::last_write_time(OutputPath) : std::filesystem::file_time_type::min();
-        auto const InputWriteTime = std::filesystem::last_write_time(Path);
-        
         bool AnyNewer = false;
-        if (InputWriteTime > OutputWriteTime) {
+        if (!std::filesystem::exists(OutputPath)) {
             AnyNewer = true;
-            if (!Params.Silent) Log(Path, "Input is newer than output");
-        } else {
-            for (auto header : GetAllHeaders(Path, Params.IncludePaths, Params.Silent)) {
-                if (!std::filesystem::exists(header)) {
-                    // Print in red
-                    //std::cerr << "\033[31m" << "Header " << header << " does not exist" << "\033[0m" << std::endl;
-                    continue;
-                }
-                if (OutputPath != header && std::filesystem::last_write_time(header) > OutputWriteTime) {
-                    AnyNewer = true;
-                    if (!Params.Silent) Log(Path, "Header " + header + " is newer than output");
-                    break;
-                }
-            }
+            if (!Params.Silent) Log(Path, "Output does not exist");
+        } else if (std::optional<std::string> Changed = Graph.FindChangedDependency(Path)) {
+            AnyNewer = true;
+            if (!Params.Silent) Log(Path, (*Changed == Path.string()) ? "No recorded dependencies" : "Header " + *Changed + " changed");
         }
 
-        if (AnyNewer) {
-            GlobalAnyNewer = true;
-        }
+        if (!AnyNewer) {
+            if (!Params.Silent) Log(Path, "No changes detected");
 
-        if (!AnyNewer && !Params.Silent) Log(Path, "No changes detected");
+            // Outputs from before depfiles were written still need one for the build system
+            if (!std::filesystem::exists(GetDepfilePath(OutputPath))) WriteDepfile(GetDepfilePath(OutputPath), OutputPath, Graph.GetDependencies(Path));
+            return false;
+        }
 
-        if (AnyNewer) {
-            std::filesystem::copy_file(
-                std::filesystem::path(AR_RESOURCES_DIR) / "null_generated.h",
-                OutputPath,
-                std::filesystem::copy_options::overwrite_existing
-            );
+        // The file must exist for the input to parse, and files from older versions don't hide their contents while parsing
+        {
+            std::ifstream Existing(OutputPath);
+            std::string ExistingContents((std::istreambuf_iterator<char>(Existing)), std::istreambuf_iterator<char>());
+            if (ExistingContents.find(GeneratingMacro) == std::string::npos) {
+                WriteIfChanged(OutputPath, NullGenerated);
+            }
         }
 
-        // If nothing newer, try to load the cached generator
-        std::optional<ImplementationGeneratorSet> Generators = AnyNewer ? std::nullopt : GetCachedGenerator(Path);
+        ImplementationGeneratorSet Generators = GenerateFile(Path);
 
-        if (!Generators) {
-            GeneratorContext Context(Path, Params.IncludePaths, Params.Silent);
+        Timings.Record(Path, std::chrono::duration<double>(std::chrono::steady_clock::now() - StartTime).count());
 
-            Generators = Context.Generators;
+        {
+            TraceScope WriteScope("WriteOutput", OutputPath);
+            // Reused by every file this worker writes
+            thread_local CodeWriter GeneratedFile;
+            GeneratedFile.Clear();
 
-            SaveCachedGenerator(Path, *Generators);
-        }
+            GeneratedFile << "#pragma once\n\n";
+            GeneratedFile << "#ifdef " GeneratingMacro << '\n';
+            GeneratedFile << NullGenerated << '\n';
+            GeneratedFile << "#else\n\n";
+            GeneratedFile << "#include <AutoReflectDecls.hpp>\n\n";
 
-        if (AnyNewer) {
-            std::ofstream GeneratedFile(OutputPath, std::ios::ate);
-
-            GeneratedFile << "#pragma once" << std::endl << std::endl;
-            GeneratedFile << "#include <AutoReflectDecls.hpp>" << std::endl << std::endl;
+            // Without a main impl the file carries everything itself, the base impls are defined by the first one included
+            if (InlineMode) {
+                GeneratedFile << "#ifndef AR_IMPL_QUALIFIER\n";
+                GeneratedFile << "#define AR_IMPL_QUALIFIER inline\n";
+                GeneratedFile << "#endif\n";
+                GeneratedFile << BaseImpls << "\n\n";
+            }
 
             // First, do all forward decls in the header
-            for (auto const& kvp : Generators->Generators) {
-                if (Generators->NonTemplateTypes.find(kvp.first) == Generators->NonTemplateTypes.end()) {
+            for (auto const& kvp : Generators.Generators) {
+                if (Generators.NonTemplateTypes.find(kvp.first) == Generators.NonTemplateTypes.end()) {
                     continue; // Skip templates
                 }
-                GeneratedFile << kvp.second.Generate(InlineMode ? GenMode::InlineMode : GenMode::ForwardDeclMode) << std::endl;
+                kvp.second.Generate(GeneratedFile, InlineMode ? GenMode::InlineForwardDeclMode : GenMode::ForwardDeclMode);
+                GeneratedFile << '\n';
             }
 
             // Then template impls only
-            for (auto const& kvp : Generators->Generators) {
-                if (Generators->NonTemplateTypes.find(kvp.first) != Generators->NonTemplateTypes.end()) {
+            for (auto const& kvp : Generators.Generators) {
+                if (Generators.NonTemplateTypes.find(kvp.first) != Generators.NonTemplateTypes.end()) {
                     continue; // Skip non-templates
                 }
-                GeneratedFile << kvp.second.Generate(GenMode::RegularMode) << std::endl;
+                kvp.second.Generate(GeneratedFile, GenMode::RegularMode);
+                GeneratedFile << '\n';
             }
 
-            GeneratedFile << std::ifstream(std::filesystem::path(AR_RESOURCES_DIR) / "BaseTemplateImpls.txt").rdbuf() << std::endl << std::endl;
+            GeneratedFile << BaseTemplateImpls << "\n\n";
+
+            // Non-template impls go last, their calls aren't dependent so everything they use must be declared above
+            if (InlineMode) {
+                for (auto const& kvp : Generators.Generators) {
+                    if (Generators.NonTemplateTypes.find(kvp.first) == Generators.NonTemplateTypes.end()) {
+                        continue; // Skip templates
+                    }
+                    kvp.second.Generate(GeneratedFile, GenMode::InlineMode);
+                    GeneratedFile << '\n';
+                }
+                Generators.GenRegistryReflectionImpl(GeneratedFile);
+            }
+
+            GeneratedFile << "#endif // " GeneratingMacro << '\n';
+
+            if (!GeneratedFile.WriteIfChanged(OutputPath) && !Params.Silent) {
+                Log(Path, "Output unchanged");
+            }
+            WriteDepfile(GetDepfilePath(OutputPath), OutputPath, Graph.GetDependencies(Path));
         }
 
-        if (!InlineMode) {
-            std::lock_guard<std::mutex> Lock(SharedContextMut);
+        std::unique_lock<std::mutex> Lock = LockTraced(SharedContextMut);
+        FileGenerators[Path] = std::move(Generators);
+        return true;
+    }
+
+    // Lists everything an output was generated from, so build systems only run AutoReflect when one of them changed
+    static std::filesystem::path GetDepfilePath(std::filesystem::path const& OutputPath) {
+        std::filesystem::path DepfilePath = OutputPath;
+        DepfilePath += ".d";
+        return DepfilePath;
+    }
+
+    std::filesystem::path GetShardPath(size_t Shard) const {
+        std::filesystem::path ShardPath = Params.MainImpl;
+        ShardPath += ".shard" + std::to_string(Shard) + ".gen.cpp";
+        return ShardPath;
+    }
+
+    // Each non-template type goes to the shard picked by the hash of its name, so adding or changing a type only rewrites its own shard
+    // A shard includes the inputs that declare its types, which bring in the forward declarations of everything they use
+    void WriteShards(ImplementationGeneratorSet const& GlobalGenerators, std::map<std::string, std::filesystem::path> const& TypeOrigins) {
+        TraceScope Scope("WriteShards");
+        std::vector<std::set<std::filesystem::path>> ShardIncludes(Params.Shards);
+        std::vector<CodeWriter> ShardImpls(Params.Shards);
+
+        for (auto const& kvp : GlobalGenerators.Generators) {
+            if (GlobalGenerators.NonTemplateTypes.find(kvp.first) == GlobalGenerators.NonTemplateTypes.end()) continue;
+
+            size_t const Shard = HashBytes(kvp.first.data(), kvp.first.size()) % Params.Shards;
+            ShardIncludes[Shard].insert(TypeOrigins.at(kvp.first));
+            ShardImpls[Shard] << "// " << kvp.first << '\n';
+            kvp.second.Generate(ShardImpls[Shard], GenMode::RegularMode);
+            ShardImpls[Shard] << '\n';
+        }
+
+        for (size_t Shard = 0; Shard < Params.Shards; ++Shard) {
+            std::filesystem::path const ShardPath = GetShardPath(Shard);
+            std::filesystem::path ShardDir = ShardPath.parent_path();
+            if (ShardDir.empty()) ShardDir = ".";
+
+            CodeWriter ShardFile;
+            ShardFile << "#include <AutoReflectDecls.hpp>\n\n";
+            for (auto const& Include : ShardIncludes[Shard]) {
+                ShardFile << "#include \"" << std::filesystem::proximate(Include, ShardDir).generic_string() << "\"\n";
+            }
+            ShardFile << '\n';
+            ShardFile << ShardImpls[Shard].View();
+
+            if (!ShardFile.WriteIfChanged(ShardPath) && !Params.Silent) {
+                Log(ShardPath, "Output unchanged");
+            }
+        }
+
+        // Shards left over from a run with a higher count would define everything twice
+        for (size_t Shard = Params.Shards; std::filesystem::exists(GetShardPath(Shard)); ++Shard) {
+            std::filesystem::remove(GetShardPath(Shard));
+        }
+    }
 
-            // TODO: Handle errors vector returned from this operation
-            GlobalGenerators.Combine(*Generators);
+    void WriteMainImpl() {
+        TraceScope Scope("WriteMainImpl", Params.MainImplOutput);
+        ImplementationGeneratorSet GlobalGenerators;
+        std::map<std::string, std::filesystem::path> TypeOrigins;
+        {
+            TraceScope CombineScope("Combine");
+            for (auto const& Path : Params.FilesToParse) {
+                auto const Found = FileGenerators.find(Path);
+                if (Found == FileGenerators.end()) continue;
+
+                for (auto const& kvp : Found->second.Generators) {
+                    TypeOrigins.emplace(kvp.first, Path);
+                }
+
+                // TODO: Handle errors vector returned from this operation
+                GlobalGenerators.Combine(Found->second);
+            }
         }
-    }, Params.FilesToParse);
 
-    if (!InlineMode && GlobalAnyNewer) {
-        std::ofstream MainImplFile = std::ofstream(Params.MainImplOutput, std::ios::ate);
+        MainImplFile.Clear();
         
-        MainImplFile << "// Base forward declarations" << std::endl;
-        MainImplFile << "#include <AutoReflectDecls.hpp>" << std::endl << std::endl;
+        MainImplFile << "// Base forward declarations\n";
+        MainImplFile << "#include <AutoReflectDecls.hpp>\n\n";
 
-        MainImplFile << "// Type forward declarations" << std::endl;
+        MainImplFile << "// Type forward declarations\n";
         for (auto const& kvp : GlobalGenerators.Generators) {
-            MainImplFile << "// " << kvp.first << std::endl;
-            MainImplFile << kvp.second.Generate(GenMode::ForwardDeclMode) << std::endl;
+            MainImplFile << "// " << kvp.first << '\n';
+            kvp.second.Generate(MainImplFile, GenMode::ForwardDeclMode);
+            MainImplFile << '\n';
         }
 
-        MainImplFile << "// Base implementations" << std::endl;
-        MainImplFile << std::ifstream(std::filesystem::path(AR_RESOURCES_DIR) / "BaseImpls.txt").rdbuf() << std::endl << std::endl;
-        MainImplFile << "// Base template implementations" << std::endl;
-        MainImplFile << std::ifstream(std::filesystem::path(AR_RESOURCES_DIR) / "BaseTemplateImpls.txt").rdbuf() << std::endl << std::endl;
+        MainImplFile << "// Base implementations\n";
+        MainImplFile << BaseImpls << "\n\n";
+        MainImplFile << "// Base template implementations\n";
+        MainImplFile << BaseTemplateImpls << "\n\n";
 
-        MainImplFile << "// std::any implementations" << std::endl;
-        MainImplFile << GlobalGenerators.GenDynamicReflectionImpl() << std::endl;
+        MainImplFile << "// std::any implementations\n";
+        GlobalGenerators.GenDynamicReflectionImpl(MainImplFile);
+        MainImplFile << '\n';
 
-        MainImplFile << "// Type implementations" << std::endl;
+        MainImplFile << "// Type implementations\n";
         for (auto const& kvp : GlobalGenerators.Generators) {
-            MainImplFile << "// " << kvp.first << std::endl;
-            MainImplFile << kvp.second.Generate(GenMode::RegularMode) << std::endl;
+            if (Params.Shards > 0 && GlobalGenerators.NonTemplateTypes.find(kvp.first) != GlobalGenerators.NonTemplateTypes.end()) {
+                continue; // In a shard
+            }
+            MainImplFile << "// " << kvp.first << '\n';
+            kvp.second.Generate(MainImplFile, GenMode::RegularMode);
+            MainImplFile << '\n';
+        }
+
+        if (Params.Shards > 0) WriteShards(GlobalGenerators, TypeOrigins);
+
+        if (!MainImplFile.WriteIfChanged(Params.MainImplOutput) && !Params.Silent) {
+            Log(Params.MainImplOutput, "Output unchanged");
         }
+
+        // The main impl, and the shards written with it, depend on every input and everything they include
+        std::set<std::string> Dependencies;
+        for (auto const& Path : Params.FilesToParse) {
+            Dependencies.insert(Path.string());
+            for (auto const& Dep : Graph.GetDependencies(Path)) Dependencies.insert(Dep);
+        }
+        WriteDepfile(GetDepfilePath(Params.MainImplOutput), Params.MainImplOutput, std::vector<std::string>(Dependencies.begin(), Dependencies.end()));
+    }
+
+    std::string const& GetCanonicalPath(std::string const& Path) {
+        auto Found = CanonicalPaths.find(Path);
+        if (Found == CanonicalPaths.end()) {
+            std::error_code Ec;
+            std::filesystem::path Canonical = std::filesystem::weakly_canonical(Path, Ec);
+            Found = CanonicalPaths.emplace(Path, (Ec ? std::filesystem::absolute(Path) : Canonical).string()).first;
+        }
+        return Found->second;
+    }
+public:
+    GenerationSession(InputParams const& Params)
+        : Params(Params)
+        , InlineMode(Params.MainImpl.empty())
+        , Pool(Params.Jobs)
+    {
+        Timings.Load(TimingsPath);
+        Graph.Load(GraphPath);
+
+        for (auto const& Path : Params.FilesToParse) {
+            ProjectFiles.insert(GetCanonicalPath(Path.string()));
+        }
+    }
+
+    // Regenerates every stale input, and the main impl if any of them changed
+    // If ChangedFiles is given, only those files are checked, otherwise every recorded file is
+    void Run(std::optional<std::set<std::string>> const& ChangedFiles = std::nullopt) {
+        PchChecked = false;
+
+        if (ChangedFiles) {
+            std::vector<std::string> Names;
+            for (auto const& Name : Graph.GetFiles()) {
+                if (ChangedFiles->find(GetCanonicalPath(Name)) != ChangedFiles->end()) Names.push_back(Name);
+            }
+            TraceScope SweepScope("Sweep");
+            Graph.SweepFiles(Pool, Names);
+        } else {
+            // A single stat of every recorded file is all a no-op run needs
+            TraceScope SweepScope("Sweep");
+            Graph.Sweep(Pool);
+        }
+
+        std::atomic_bool GlobalAnyNewer = false;
+
+        Pool.ParallelFor([this, &GlobalAnyNewer](std::filesystem::path const& Path) {
+            if (ProcessFile(Path)) GlobalAnyNewer = true;
+        }, Params.FilesToParse, [this](std::filesystem::path const& Path) {
+            return Timings.EstimateCost(Path);
+        });
+
+        // Generators of unchanged files are only needed when the main impl is rewritten
+        bool const MainImplMissing = !InlineMode && (!std::filesystem::exists(Params.MainImplOutput) || !std::filesystem::exists(GetDepfilePath(Params.MainImplOutput)));
+        if (!InlineMode && (GlobalAnyNewer || MainImplMissing)) {
+            std::vector<std::filesystem::path> NotLoaded;
+            for (auto const& Path : Params.FilesToParse) {
+                std::filesystem::path OutputPath = Path;
+                OutputPath += GeneratedSuffix;
+                if (OutputPath != Params.MainImplOutput && FileGenerators.find(Path) == FileGenerators.end()) NotLoaded.push_back(Path);
+            }
+
+            Cache.Open();
+            Pool.ParallelFor([this](std::filesystem::path const& Path) {
+                std::optional<ImplementationGeneratorSet> Generators;
+                {
+                    TraceScope Scope("CacheGet", Path);
+                    Generators = Cache.Get(Path);
+                }
+
+                if (!Generators) {
+                    if (!Params.Silent) Log(Path, "No cached generator");
+
+                    Generators = GenerateFile(Path);
+                }
+
+                std::unique_lock<std::mutex> Lock = LockTraced(SharedContextMut);
+                FileGenerators[Path] = std::move(*Generators);
+            }, NotLoaded);
+
+            WriteMainImpl();
+        }
+
+        {
+            TraceScope Scope("SaveState");
+            Cache.Compact();
+            Graph.Save(GraphPath);
+            Timings.Save(TimingsPath);
+        }
+
+        TraceRecorder::Save();
+    }
+
+    std::vector<std::filesystem::path> GetWatchedFiles() const {
+        std::vector<std::filesystem::path> Files(Params.FilesToParse.begin(), Params.FilesToParse.end());
+        for (auto const& Name : Graph.GetFiles()) Files.push_back(Name);
+        return Files;
+    }
+};
+
+int main(int argc, char** argv) {
+    InputParams Params(argc, argv);
+
+    // Hand the work to a resident watcher if one is running, otherwise do it here
+    if (!Params.ConnectSocket.empty()) {
+        if (std::optional<int> Result = SendWatcherRequest(Params.ConnectSocket, "sync")) return *Result;
+        if (!Params.Silent) Log(Params.ConnectSocket, "No watcher listening, generating in this process");
+    }
+
+    if (Params.UseLibClang && !IsLibClangAvailable()) {
+        std::cerr << "--libclang requires AutoReflect to be built with -DAR_USE_LIBCLANG=ON" << std::endl;
+        return 1;
+    }
+
+    if (Params.MainImpl.empty() && Params.Shards > 0) {
+        std::cerr << "--shards splits the main implementation, it needs a main file given with -M" << std::endl;
+        return 1;
+    }
+
+    // Workers and clang processes share the same budget
+    ProcessBudget::SetLimit(Params.Jobs);
+
+    if (!Params.TracePath.empty()) TraceRecorder::Start(Params.TracePath);
+
+    GenerationSession Session(Params);
+    Session.Run();
+
+    if (Params.Watch || !Params.SocketPath.empty()) {
+        return RunWatcher(WatchCallbacks {
+            [&Session]() { return Session.GetWatchedFiles(); },
+            [&Session](std::set<std::string> const& ChangedFiles) { Session.Run(ChangedFiles); }
+        }, Params.SocketPath, Params.Silent);
     }
     
     return 0;
@@ -0,0 +1,400 @@
+#include "GeneratorCache.hpp"
+
+#include <fstream>
+#include <cstring>
+#include <cerrno>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    constexpr char CacheMagic[8] = { 'A', 'R', 'G', 'E', 'N', 'C', 'A', 'C' };
+    constexpr uint32_t CacheVersion = 3;
+    constexpr uint32_t RecordMagic = 0x52474541; // "AEGR"
+
+    struct CacheHeader {
+        char Magic[8];
+        uint32_t Version;
+        uint32_t IndexSlots;
+        uint64_t IndexOffset;
+
+        // Where appended records start, the end of the index after a compaction
+        uint64_t CompactedEnd;
+    };
+
+    struct RecordHeader {
+        uint32_t Magic;
+        uint32_t Size; // Including this header
+        uint64_t KeyHash;
+    };
+
+    struct IndexEntry {
+        uint64_t KeyHash;
+        uint64_t Offset; // 0 for an empty slot
+    };
+
+    uint64_t HashKey(std::string_view Key) {
+        return HashBytes(Key.data(), Key.size());
+    }
+
+    bool ReadHeader(char const* Data, size_t Size, CacheHeader& Header) {
+        if (Size < sizeof(CacheHeader)) return false;
+        memcpy(&Header, Data, sizeof(CacheHeader));
+        if (memcmp(Header.Magic, CacheMagic, sizeof(CacheMagic)) != 0 || Header.Version != CacheVersion) return false;
+        if (Header.CompactedEnd < sizeof(CacheHeader) || Header.CompactedEnd > Size) return false;
+        if (Header.IndexSlots != 0 && Header.IndexOffset + static_cast<uint64_t>(Header.IndexSlots) * sizeof(IndexEntry) > Header.CompactedEnd) return false;
+        return true;
+    }
+
+    // Returns the record header at Offset if it lies entirely within the file
+    std::optional<RecordHeader> ReadRecordHeader(char const* Data, size_t Size, uint64_t Offset) {
+        if (Offset + sizeof(RecordHeader) > Size) return std::nullopt;
+        RecordHeader Header;
+        memcpy(&Header, Data + Offset, sizeof(RecordHeader));
+        if (Header.Magic != RecordMagic || Header.Size < sizeof(RecordHeader) || Offset + Header.Size > Size) return std::nullopt;
+        return Header;
+    }
+
+    // Bounds checked reads from one record, any overrun marks the record as invalid
+    struct RecordReader {
+        char const* Data;
+        size_t Size;
+        size_t Pos = 0;
+        bool Valid = true;
+
+        uint32_t ReadU32() {
+            if (Pos + 4 > Size) {
+                Valid = false;
+                return 0;
+            }
+            uint32_t Val;
+            memcpy(&Val, Data + Pos, 4);
+            Pos += 4;
+            return Val;
+        }
+
+        std::string_view ReadString() {
+            uint32_t const Len = ReadU32();
+            if (!Valid || Pos + Len > Size) {
+                Valid = false;
+                return std::string_view();
+            }
+            std::string_view Str(Data + Pos, Len);
+            Pos += Len;
+            return Str;
+        }
+    };
+
+    std::string_view ReadRecordKey(char const* Data, size_t Size, uint64_t Offset, RecordHeader const& Header) {
+        RecordReader Reader { Data + Offset + sizeof(RecordHeader), Header.Size - sizeof(RecordHeader) };
+        std::string_view Key = Reader.ReadString();
+        return Reader.Valid ? Key : std::string_view();
+    }
+
+    void WriteU32(std::string& Out, uint32_t Val) {
+        Out.append(reinterpret_cast<char const*>(&Val), 4);
+    }
+
+    void WriteString(std::string& Out, std::string_view Str) {
+        WriteU32(Out, static_cast<uint32_t>(Str.size()));
+        Out.append(Str.data(), Str.size());
+    }
+
+    std::string EncodeRecord(std::string const& Key, ImplementationGeneratorSet const& Set) {
+        std::vector<std::string_view> Strings;
+        std::unordered_map<std::string_view, uint32_t> Interned;
+        auto Intern = [&](std::string const& Str) {
+            auto const [It, Inserted] = Interned.emplace(Str, static_cast<uint32_t>(Strings.size()));
+            if (Inserted) Strings.push_back(Str);
+            return It->second;
+        };
+
+        std::vector<uint32_t> Refs;
+        for (auto const& [Name, Generator] : Set.Generators) {
+            Refs.push_back(Intern(Name));
+            Refs.push_back(Intern(Generator.Templates));
+            Refs.push_back(Intern(Generator.FullTypeName));
+            Refs.push_back(Intern(Generator.SerializeFieldsSource));
+            Refs.push_back(Intern(Generator.DeserializeFieldsSource));
+            Refs.push_back(static_cast<uint32_t>(Generator.FieldNames.size()));
+            for (auto const& Field : Generator.FieldNames) Refs.push_back(Intern(Field));
+        }
+        for (auto const& Name : Set.NonTemplateTypes) {
+            Refs.push_back(Intern(Name));
+        }
+
+        std::string Out(sizeof(RecordHeader), '\0');
+        WriteString(Out, Key);
+        WriteU32(Out, static_cast<uint32_t>(Strings.size()));
+        for (auto const& Str : Strings) WriteString(Out, Str);
+        WriteU32(Out, static_cast<uint32_t>(Set.Generators.size()));
+        WriteU32(Out, static_cast<uint32_t>(Set.NonTemplateTypes.size()));
+        for (uint32_t Ref : Refs) WriteU32(Out, Ref);
+
+        RecordHeader Header { RecordMagic, static_cast<uint32_t>(Out.size()), HashKey(Key) };
+        memcpy(Out.data(), &Header, sizeof(RecordHeader));
+        return Out;
+    }
+
+    std::optional<ImplementationGeneratorSet> DecodeRecord(char const* Data, size_t Size) {
+        RecordReader Reader { Data + sizeof(RecordHeader), Size - sizeof(RecordHeader) };
+        Reader.ReadString(); // Key
+
+        uint32_t const NumStrings = Reader.ReadU32();
+        if (!Reader.Valid || NumStrings > Reader.Size) return std::nullopt;
+        std::vector<std::string_view> Strings(NumStrings);
+        for (auto& Str : Strings) Str = Reader.ReadString();
+
+        uint32_t const NumGenerators = Reader.ReadU32();
+        uint32_t const NumNonTemplate = Reader.ReadU32();
+        if (!Reader.Valid) return std::nullopt;
+
+        auto ReadRef = [&]() -> std::string {
+            uint32_t const Ref = Reader.ReadU32();
+            if (Ref >= Strings.size()) {
+                Reader.Valid = false;
+                return std::string();
+            }
+            return std::string(Strings[Ref]);
+        };
+
+        ImplementationGeneratorSet Set;
+        for (uint32_t i = 0; i < NumGenerators && Reader.Valid; ++i) {
+            std::string Name = ReadRef();
+            ImplementationGenerator Generator;
+            Generator.Templates = ReadRef();
+            Generator.FullTypeName = ReadRef();
+            Generator.SerializeFieldsSource = ReadRef();
+            Generator.DeserializeFieldsSource = ReadRef();
+            uint32_t const NumFields = Reader.ReadU32();
+            for (uint32_t j = 0; j < NumFields && Reader.Valid; ++j) Generator.FieldNames.push_back(ReadRef());
+            Set.Generators.emplace(std::move(Name), std::move(Generator));
+        }
+        for (uint32_t i = 0; i < NumNonTemplate && Reader.Valid; ++i) {
+            Set.NonTemplateTypes.insert(ReadRef());
+        }
+
+        if (!Reader.Valid) return std::nullopt;
+        return Set;
+    }
+
+    // Exclusive or shared lock on a separate file, compaction replaces the cache file itself
+    struct CacheFileLock {
+#ifndef _WIN32
+        int Fd = -1;
+        CacheFileLock(std::filesystem::path const& LockPath, bool Exclusive) {
+            Fd = open(LockPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            if (Fd < 0) throw std::runtime_error("Could not open " + LockPath.string());
+            while (flock(Fd, Exclusive ? LOCK_EX : LOCK_SH) != 0 && errno == EINTR) { }
+        }
+        ~CacheFileLock() { close(Fd); }
+#else
+        // Only one process is expected to use the cache at a time on Windows
+        CacheFileLock(std::filesystem::path const&, bool) { }
+#endif
+        CacheFileLock(CacheFileLock const&) = delete;
+        CacheFileLock& operator=(CacheFileLock const&) = delete;
+    };
+
+    std::string ReadWholeFile(std::filesystem::path const& Path) {
+        std::ifstream File(Path, std::ios::binary);
+        return std::string((std::istreambuf_iterator<char>(File)), std::istreambuf_iterator<char>());
+    }
+}
+
+GeneratorCache::GeneratorCache(std::filesystem::path const& Path)
+    : Path(Path)
+    , LockPath(Path.string() + ".lock")
+{ }
+
+GeneratorCache::~GeneratorCache() {
+    Close();
+}
+
+void GeneratorCache::Close() {
+#ifndef _WIN32
+    if (Data) munmap(const_cast<char*>(Data), Size);
+#else
+    Contents.clear();
+#endif
+    Data = nullptr;
+    Size = 0;
+    IndexSlots = 0;
+    IndexOffset = 0;
+    Appended.clear();
+}
+
+void GeneratorCache::Open() {
+    Close();
+    if (!std::filesystem::exists(Path)) return;
+
+    std::filesystem::create_directories(Path.parent_path());
+    CacheFileLock Lock(LockPath, false);
+
+#ifndef _WIN32
+    int const Fd = open(Path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (Fd < 0) return;
+    struct stat Info;
+    if (fstat(Fd, &Info) == 0 && Info.st_size > 0) {
+        void* Mapped = mmap(nullptr, static_cast<size_t>(Info.st_size), PROT_READ, MAP_PRIVATE, Fd, 0);
+        if (Mapped != MAP_FAILED) {
+            Data = static_cast<char const*>(Mapped);
+            Size = static_cast<size_t>(Info.st_size);
+        }
+    }
+    close(Fd);
+#else
+    std::string File = ReadWholeFile(Path);
+    Contents.assign(File.begin(), File.end());
+    Data = Contents.data();
+    Size = Contents.size();
+#endif
+
+    CacheHeader Header;
+    if (!Data || !ReadHeader(Data, Size, Header)) {
+        // Unknown version or damaged, Put starts the file over
+        Close();
+        return;
+    }
+
+    IndexSlots = Header.IndexSlots;
+    IndexOffset = Header.IndexOffset;
+
+    // Only the headers of appended records are read, their contents are decoded on demand
+    uint64_t Offset = Header.CompactedEnd;
+    while (std::optional<RecordHeader> Record = ReadRecordHeader(Data, Size, Offset)) {
+        std::string_view Key = ReadRecordKey(Data, Size, Offset, *Record);
+        if (!Key.empty()) Appended[std::string(Key)] = Offset;
+        Offset += Record->Size;
+    }
+}
+
+std::optional<uint64_t> GeneratorCache::FindRecord(std::string const& Key) const {
+    auto const Found = Appended.find(Key);
+    if (Found != Appended.end()) return Found->second;
+    if (IndexSlots == 0) return std::nullopt;
+
+    uint64_t const Hash = HashKey(Key);
+    for (uint32_t Probe = 0; Probe < IndexSlots; ++Probe) {
+        IndexEntry Entry;
+        memcpy(&Entry, Data + IndexOffset + ((Hash + Probe) & (IndexSlots - 1)) * sizeof(IndexEntry), sizeof(IndexEntry));
+        if (Entry.Offset == 0) return std::nullopt;
+        if (Entry.KeyHash != Hash) continue;
+
+        std::optional<RecordHeader> Record = ReadRecordHeader(Data, Size, Entry.Offset);
+        if (Record && ReadRecordKey(Data, Size, Entry.Offset, *Record) == Key) return Entry.Offset;
+    }
+
+    return std::nullopt;
+}
+
+std::optional<ImplementationGeneratorSet> GeneratorCache::Get(std::filesystem::path const& Input) const {
+    if (!Data) return std::nullopt;
+
+    std::optional<uint64_t> const Offset = FindRecord(Input.string());
+    if (!Offset) return std::nullopt;
+
+    std::optional<RecordHeader> Record = ReadRecordHeader(Data, Size, *Offset);
+    if (!Record) return std::nullopt;
+    return DecodeRecord(Data + *Offset, Record->Size);
+}
+
+void GeneratorCache::Put(std::filesystem::path const& Input, ImplementationGeneratorSet const& Set) {
+    std::string const Record = EncodeRecord(Input.string(), Set);
+
+    std::lock_guard<std::mutex> Guard(WriteMutex);
+    std::filesystem::create_directories(Path.parent_path());
+    CacheFileLock Lock(LockPath, true);
+
+    std::fstream File(Path, std::ios::in | std::ios::out | std::ios::binary);
+    CacheHeader Header;
+    char HeaderData[sizeof(CacheHeader)] = { };
+    bool Valid = false;
+    if (File) {
+        File.read(HeaderData, sizeof(CacheHeader));
+        File.seekg(0, std::ios::end);
+        Valid = File.gcount() == sizeof(CacheHeader) && ReadHeader(HeaderData, static_cast<size_t>(File.tellg()), Header);
+    }
+
+    if (!Valid) {
+        // Start over with an empty cache
+        File = std::fstream(Path, std::ios::out | std::ios::trunc | std::ios::binary);
+        memcpy(Header.Magic, CacheMagic, sizeof(CacheMagic));
+        Header.Version = CacheVersion;
+        Header.IndexSlots = 0;
+        Header.IndexOffset = 0;
+        Header.CompactedEnd = sizeof(CacheHeader);
+        File.write(reinterpret_cast<char const*>(&Header), sizeof(CacheHeader));
+    }
+
+    File.seekp(0, std::ios::end);
+    File.write(Record.data(), Record.size());
+    if (!File) throw std::runtime_error("Could not write " + Path.string());
+    Written = true;
+}
+
+void GeneratorCache::Compact() {
+    std::lock_guard<std::mutex> Guard(WriteMutex);
+    if (!Written || !std::filesystem::exists(Path)) return;
+    Written = false;
+    CacheFileLock Lock(LockPath, true);
+
+    std::string const Old = ReadWholeFile(Path);
+    CacheHeader Header;
+    if (!ReadHeader(Old.data(), Old.size(), Header) || Header.CompactedEnd == Old.size()) return;
+
+    // Latest record of every key, compacted ones first so appended ones replace them
+    std::map<std::string_view, uint64_t> Latest;
+    uint64_t Offset = sizeof(CacheHeader);
+    uint64_t const RecordsEnd = Header.IndexSlots ? Header.IndexOffset : Header.CompactedEnd;
+    while (Offset < RecordsEnd) {
+        std::optional<RecordHeader> Record = ReadRecordHeader(Old.data(), RecordsEnd, Offset);
+        if (!Record) break;
+        Latest[ReadRecordKey(Old.data(), Old.size(), Offset, *Record)] = Offset;
+        Offset += Record->Size;
+    }
+    Offset = Header.CompactedEnd;
+    while (std::optional<RecordHeader> Record = ReadRecordHeader(Old.data(), Old.size(), Offset)) {
+        Latest[ReadRecordKey(Old.data(), Old.size(), Offset, *Record)] = Offset;
+        Offset += Record->Size;
+    }
+    Latest.erase(std::string_view());
+
+    uint32_t Slots = 16;
+    while (Slots < Latest.size() * 2) Slots *= 2;
+    std::vector<IndexEntry> Index(Slots, IndexEntry { 0, 0 });
+
+    std::string New(sizeof(CacheHeader), '\0');
+    for (auto const& [Key, OldOffset] : Latest) {
+        RecordHeader Record;
+        memcpy(&Record, Old.data() + OldOffset, sizeof(RecordHeader));
+
+        uint64_t Slot = Record.KeyHash & (Slots - 1);
+        while (Index[Slot].Offset != 0) Slot = (Slot + 1) & (Slots - 1);
+        Index[Slot] = IndexEntry { Record.KeyHash, New.size() };
+
+        New.append(Old.data() + OldOffset, Record.Size);
+    }
+
+    memcpy(Header.Magic, CacheMagic, sizeof(CacheMagic));
+    Header.Version = CacheVersion;
+    Header.IndexSlots = Slots;
+    Header.IndexOffset = New.size();
+    New.append(reinterpret_cast<char const*>(Index.data()), Index.size() * sizeof(IndexEntry));
+    Header.CompactedEnd = New.size();
+    memcpy(New.data(), &Header, sizeof(CacheHeader));
+
+    // Readers that already mapped the old file keep it until they open again
+    std::filesystem::path const TempPath = Path.string() + ".tmp";
+    {
+        std::ofstream Temp(TempPath, std::ios::binary | std::ios::trunc);
+        Temp.write(New.data(), New.size());
+        if (!Temp) throw std::runtime_error("Could not write " + TempPath.string());
+    }
+    std::filesystem::rename(TempPath, Path);
+}
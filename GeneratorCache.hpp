@@ -0,0 +1,50 @@
+#pragma once
+
+#include "Generating.hpp"
+
+#include <unordered_map>
+#include <mutex>
+
+// Generators of every input in one binary file, memory mapped for reading
+// Layout: header, compacted records, open addressed index of the compacted records, then records appended since
+// Each record interns its strings once, generators refer to them by index
+// Integers are stored in native byte order, the cache never leaves the machine that wrote it
+class GeneratorCache {
+private:
+    std::filesystem::path Path;
+    std::filesystem::path LockPath;
+
+    char const* Data = nullptr;
+    size_t Size = 0;
+#ifdef _WIN32
+    std::vector<char> Contents;
+#endif
+
+    uint32_t IndexSlots = 0;
+    uint64_t IndexOffset = 0;
+
+    // Records appended after the last compaction, the latest record of a key wins
+    std::unordered_map<std::string, uint64_t> Appended;
+
+    std::mutex WriteMutex;
+    bool Written = false;
+
+    void Close();
+    std::optional<uint64_t> FindRecord(std::string const& Key) const;
+public:
+    GeneratorCache(std::filesystem::path const& Path);
+    ~GeneratorCache();
+    GeneratorCache(GeneratorCache const&) = delete;
+    GeneratorCache& operator=(GeneratorCache const&) = delete;
+
+    // Maps the file as it is now, entries Put after this are not visible to Get until the next Open
+    void Open();
+
+    std::optional<ImplementationGeneratorSet> Get(std::filesystem::path const& Input) const;
+
+    // Appends a record under the file lock, safe from any thread and from other processes
+    void Put(std::filesystem::path const& Input, ImplementationGeneratorSet const& Set);
+
+    // Rewrites the file with only the latest record of each input and a new index, if this process appended anything
+    void Compact();
+};
@@ -1,10 +1,26 @@
 #pragma once
 
+// Lets the stubs in generated files know the real declarations are already visible, e.g. from the precompiled header
+#define AUTOREFLECT_DECLS
+
 #include <string>
+#include <cstring>
 #include <stdexcept>
+#include <limits>
+#include <bit>
 #include <vector>
 #include <optional>
 #include <typeinfo>
+#include <typeindex>
+#include <any>
+#include <functional>
+#include <unordered_map>
+#include <memory>
+#include <ostream>
+#include <tuple>
+#include <array>
+#include <string_view>
+#include <cstddef>
 
 #include <nlohmann/json.hpp>
 #include <glm/ext.hpp>
@@ -17,7 +33,7 @@ public:
     std::any const& GetAny() const { return Value; }
     
     inline void Reset() {
-        Value = nullptr;
+        Value.reset();
         BaseFunc = nullptr;
     }
 };
@@ -64,8 +80,168 @@ public:
     template<typename U> U& GetAs() const { return const_cast<U&>(std::any_cast<U const&>(Value)); }
 };
 
+enum class SerdeFormat {
+    Json,       // Data holds the document, Binary holds the contents of std::vector<uint8_t> fields
+    Binary,     // Binary holds the whole document, fields are written in declaration order without names
+    JsonStream  // JSON text is written by Serializer::Writer or read by Deserializer::Reader as fields arrive, Data is unused
+};
+
+// Formats JSON as the generated calls arrive, so a document never has to be held in memory as a tree
+// Every open value is a frame, which turns into an object on its first field, an array on BeginArray, or a scalar
+class JsonWriter {
+public:
+    // Text not yet flushed to the stream, or the whole document when there is no stream
+    std::string Text;
+
+    explicit JsonWriter(std::ostream* Stream);
+
+    void BeginValue(char const* Name); // Named value in the current object
+    void BeginItem();                  // Next value in the current array
+    void EndValue();                   // Ends the value started by BeginValue or BeginItem, a value with no contents is null
+    void BeginArray();                 // The current value is an array
+    void EndArray();
+
+    template<typename T>
+    void Scalar(T const& Value) {
+        if (Frames.empty() || Frames.back().State != FrameState::Pending) throw std::runtime_error("JSON stream: value written twice");
+        Scalars.dump(nlohmann::json(Value), false, false, 0);
+        Frames.back().State = FrameState::Done;
+    }
+
+    template<typename T>
+    void Named(char const* Name, T const& Value) {
+        Key(Name);
+        Scalars.dump(nlohmann::json(Value), false, false, 0);
+        FlushIfFull();
+    }
+
+    // Closes every open value and flushes the rest of the text
+    void Finish();
+private:
+    enum class FrameState { Pending, Object, Array, Done };
+    struct Frame {
+        FrameState State;
+        bool First;
+    };
+
+    std::ostream* Stream;
+    std::vector<Frame> Frames;
+    nlohmann::detail::serializer<nlohmann::json> Scalars;
+
+    void Key(char const* Name);
+    void FlushIfFull();
+};
+
+// Pulls JSON tokens from a memory-mapped file or a buffered stream, so a document is never parsed into a tree
+// Members are matched in the order they're asked for: the scan of an object stops at the requested key, and keys
+// passed on the way are remembered by hash and offset, to be read again if asked for later
+// A stream only keeps the bytes from the oldest remembered member onwards, which is nothing when keys arrive in order
+class JsonReader {
+public:
+    explicit JsonReader(std::istream& Stream);
+    // Maps the file into memory, or reads it in where mapping isn't available
+    explicit JsonReader(std::string const& Path);
+    ~JsonReader();
+
+    JsonReader(JsonReader const&) = delete;
+    JsonReader& operator=(JsonReader const&) = delete;
+
+    void BeginValue(char const* Name); // Member of the current object
+    void EndValue();                   // Skips whatever of the value wasn't read
+    void BeginArray();                 // The current value is an array
+    bool NextItem();                   // Begins the next item of the current array, false at its end
+    bool IsArray();                    // True if the current value, not yet read, is an array
+    bool NextMember(std::string_view& Key); // Begins the next member of the current object in document order, false at its end
+    bool ReadNull();                   // True and consumed if the current value is null
+
+    template<typename T>
+    void Scalar(T& Value) {
+        BeginScalar();
+        if constexpr (std::is_same_v<T, bool>) Value = ReadBool();
+        else if constexpr (std::is_same_v<T, std::string>) ReadString(Value);
+        else if constexpr (std::is_floating_point_v<T>) Value = static_cast<T>(ReadDouble());
+        else if constexpr (std::is_signed_v<T>) Value = static_cast<T>(ReadInt64());
+        else Value = static_cast<T>(ReadUInt64());
+        EndScalar();
+    }
+
+    template<typename T>
+    void Named(char const* Name, T& Value) {
+        BeginValue(Name);
+        Scalar(Value);
+        EndValue();
+    }
+
+    // Skips the rest of the document
+    void Finish();
+
+    size_t Offset() const { return Pos; }
+private:
+    enum class FrameState { Pending, Object, Array, Done };
+    struct Frame {
+        FrameState State;
+        size_t Cursor;       // Start of the value, then where the next member or item starts, npos while one read in order is open
+        bool InOrder;        // Reached by the scan of the parent, which then continues where this value ends
+        bool First;          // No item read yet
+        bool Closed;         // Scanned up to the closing brace
+        size_t SkippedBegin; // Members passed by the scan of this object start here in Skipped
+    };
+    struct SkippedMember {
+        uint64_t Hash;
+        size_t KeyOffset;
+    };
+
+    std::istream* Stream = nullptr;
+    std::vector<char> Buffer;
+    void* Mapping = nullptr;
+    size_t MappingSize = 0;
+
+    // Bytes [DataStart, DataStart + DataSize) of the input
+    char const* Data = nullptr;
+    size_t DataSize = 0;
+    size_t DataStart = 0;
+
+    size_t Pos = 0;
+    std::vector<Frame> Frames;
+    std::vector<SkippedMember> Skipped;
+    std::string Scratch;
+
+    bool Fill(size_t Offset);
+    char At(size_t Offset);
+    char Peek();
+    void Expect(char C);
+    [[noreturn]] void Error(std::string const& Message) const;
+
+    // FNV-1a
+    static uint64_t HashKey(std::string_view Key) {
+        uint64_t Hash = 14695981039346656037ull;
+        for (char C : Key) {
+            Hash ^= static_cast<uint8_t>(C);
+            Hash *= 1099511628211ull;
+        }
+        return Hash;
+    }
+
+    std::string_view ReadKey();
+    void ReadString(std::string& Value);
+    size_t ScanString(bool& Escaped);
+    void Unescape(size_t Begin, size_t End, std::string& Out);
+    std::string_view ReadToken();
+    void ReadLiteral(char const* Literal);
+    void SkipValue();
+    void SkipRest(Frame const& Top);
+
+    void BeginScalar();
+    void EndScalar();
+    bool ReadBool();
+    double ReadDouble();
+    int64_t ReadInt64();
+    uint64_t ReadUInt64();
+};
+
 class SerdeData {
 public:
+    SerdeFormat Format = SerdeFormat::Json;
     nlohmann::json Data;
     std::vector<uint8_t> Binary;
 
@@ -81,14 +257,228 @@ public:
 
 class Serializer : public SerdeData {
 public:
+    // Set while the format is JsonStream
+    std::unique_ptr<JsonWriter> Writer;
+
     nlohmann::json& AtChecked(char const* Name) override;
+
+    // Switches to JsonStream, text goes to Stream in chunks or stays in Writer->Text when there is no stream
+    void BeginStream(std::ostream* Stream = nullptr);
+    // Closes the document and flushes what's left to the stream
+    void EndStream();
+
+    // Hide the SerdeData versions, which build the DOM
+    void BeginObject(char const* Name);
+    void EndObject();
+
+    // Marks the current value as present or null, for optionals and SubclassOf
+    void WriteHasValue(bool HasValue);
+
+    void WriteBytes(void const* Bytes, size_t Size) {
+        uint8_t const* Begin = static_cast<uint8_t const*>(Bytes);
+        Binary.insert(Binary.end(), Begin, Begin + Size);
+    }
+
+    void WriteVarint(uint64_t Value) {
+        while (Value >= 0x80) {
+            Binary.push_back(static_cast<uint8_t>(Value) | 0x80);
+            Value >>= 7;
+        }
+        Binary.push_back(static_cast<uint8_t>(Value));
+    }
 };
 
 class Deserializer : public SerdeData {
 public:
+    // Read position in Binary when the format is binary
+    size_t BinaryOffset = 0;
+
+    // Set while the format is JsonStream
+    std::unique_ptr<JsonReader> Reader;
+
     nlohmann::json& AtChecked(char const* Name) override;
+
+    // Switches to JsonStream, reading from Stream or from the file at Path
+    void BeginStream(std::istream& Stream);
+    void BeginFileStream(std::string const& Path);
+    void EndStream();
+
+    // Hide the SerdeData versions, which look up the DOM
+    void BeginObject(char const* Name);
+    void EndObject();
+
+    bool ReadHasValue();
+
+    // Calls Fn(Key) once per member of the current object, in document order, with that member as the current value
+    // Key is only valid until the value is read
+    template<typename F>
+    void ForEachMember(F&& Fn) {
+        if (Format == SerdeFormat::Binary) throw std::runtime_error("Binary data has no member names");
+        if (Format == SerdeFormat::JsonStream) {
+            std::string_view Key;
+            while (Reader->NextMember(Key)) {
+                Fn(Key);
+                Reader->EndValue();
+            }
+            return;
+        }
+
+        nlohmann::json& Scope = GetCurrentScope();
+        if (!Scope.is_object()) throw std::runtime_error(std::string("Expected an object, found ") + Scope.type_name());
+        for (auto It = Scope.begin(); It != Scope.end(); ++It) {
+            Scopes.push_back(&It.value());
+            ScopeNames.push_back(It.key());
+            Fn(std::string_view(It.key()));
+            ScopeNames.pop_back();
+            Scopes.pop_back();
+        }
+    }
+
+    [[noreturn]] void MissingField(char const* Name);
+
+    size_t RemainingBytes() const { return Binary.size() - BinaryOffset; }
+
+    void ReadBytes(void* Bytes, size_t Size) {
+        if (Size > RemainingBytes()) {
+            throw std::runtime_error("Binary data ends at byte " + std::to_string(Binary.size()) + ", reading " + std::to_string(Size) + " bytes at " + std::to_string(BinaryOffset));
+        }
+        memcpy(Bytes, Binary.data() + BinaryOffset, Size);
+        BinaryOffset += Size;
+    }
+
+    uint64_t ReadVarint() {
+        uint64_t Value = 0;
+        for (int Shift = 0; Shift < 64; Shift += 7) {
+            if (BinaryOffset >= Binary.size()) throw std::runtime_error("Binary data ends inside a varint at byte " + std::to_string(BinaryOffset));
+            uint8_t const Byte = Binary[BinaryOffset++];
+            Value |= static_cast<uint64_t>(Byte & 0x7f) << Shift;
+            if (!(Byte & 0x80)) return Value;
+        }
+        throw std::runtime_error("Varint longer than 10 bytes at byte " + std::to_string(BinaryOffset));
+    }
 };
 
+// Binary encoding of primitives: bools and 8 bit integers are single bytes, wider integers are varints
+// (zigzag encoded when signed), floats are little endian IEEE 754, and strings are a varint length followed by the bytes
+template<typename T>
+inline void WritePrimitive(Serializer& Ser, T const& Value) {
+    if constexpr (std::is_same_v<T, std::string>) {
+        Ser.WriteVarint(Value.size());
+        Ser.WriteBytes(Value.data(), Value.size());
+    } else if constexpr (sizeof(T) == 1) {
+        Ser.Binary.push_back(static_cast<uint8_t>(Value));
+    } else if constexpr (std::is_floating_point_v<T>) {
+        using Bits = std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>;
+        Bits const Raw = std::bit_cast<Bits>(Value);
+        uint8_t Bytes[sizeof(T)];
+        for (size_t i = 0; i < sizeof(T); ++i) Bytes[i] = static_cast<uint8_t>(Raw >> (i * 8));
+        Ser.WriteBytes(Bytes, sizeof(T));
+    } else if constexpr (std::is_signed_v<T>) {
+        int64_t const Wide = Value;
+        Ser.WriteVarint((static_cast<uint64_t>(Wide) << 1) ^ static_cast<uint64_t>(Wide >> 63));
+    } else {
+        Ser.WriteVarint(Value);
+    }
+}
+
+template<typename T>
+inline void ReadPrimitive(Deserializer& Ser, T& Value) {
+    if constexpr (std::is_same_v<T, std::string>) {
+        uint64_t const Size = Ser.ReadVarint();
+        if (Size > Ser.RemainingBytes()) throw std::runtime_error("String of " + std::to_string(Size) + " bytes runs past the end of the binary data at byte " + std::to_string(Ser.BinaryOffset));
+        Value.resize(Size);
+        Ser.ReadBytes(Value.data(), Size);
+    } else if constexpr (std::is_same_v<T, bool>) {
+        uint8_t Byte;
+        Ser.ReadBytes(&Byte, 1);
+        Value = Byte != 0;
+    } else if constexpr (sizeof(T) == 1) {
+        Ser.ReadBytes(&Value, 1);
+    } else if constexpr (std::is_floating_point_v<T>) {
+        using Bits = std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>;
+        uint8_t Bytes[sizeof(T)];
+        Ser.ReadBytes(Bytes, sizeof(T));
+        Bits Raw = 0;
+        for (size_t i = 0; i < sizeof(T); ++i) Raw |= static_cast<Bits>(Bytes[i]) << (i * 8);
+        Value = std::bit_cast<T>(Raw);
+    } else if constexpr (std::is_signed_v<T>) {
+        uint64_t const Raw = Ser.ReadVarint();
+        int64_t const Wide = static_cast<int64_t>(Raw >> 1) ^ -static_cast<int64_t>(Raw & 1);
+        if (Wide < std::numeric_limits<T>::min() || Wide > std::numeric_limits<T>::max()) throw std::runtime_error("Integer out of range before byte " + std::to_string(Ser.BinaryOffset));
+        Value = static_cast<T>(Wide);
+    } else {
+        uint64_t const Raw = Ser.ReadVarint();
+        if (Raw > std::numeric_limits<T>::max()) throw std::runtime_error("Integer out of range before byte " + std::to_string(Ser.BinaryOffset));
+        Value = static_cast<T>(Raw);
+    }
+}
+
+// Shared by the primitive overloads, a null name writes the current scope itself
+template<typename T>
+inline void SerializePrimitive(Serializer& Ser, char const* Name, T const& Value) {
+    if (Ser.Format == SerdeFormat::Binary) {
+        WritePrimitive(Ser, Value);
+    } else if (Ser.Format == SerdeFormat::JsonStream) {
+        if (Name) Ser.Writer->Named(Name, Value); else Ser.Writer->Scalar(Value);
+    } else {
+        (Name ? Ser.AtChecked(Name) : Ser.GetCurrentScope()) = Value;
+    }
+}
+
+template<typename T>
+inline void DeserializePrimitive(Deserializer& Ser, char const* Name, T& Value) {
+    if (Ser.Format == SerdeFormat::Binary) {
+        ReadPrimitive(Ser, Value);
+    } else if (Ser.Format == SerdeFormat::JsonStream) {
+        if (Name) Ser.Reader->Named(Name, Value); else Ser.Reader->Scalar(Value);
+    } else {
+        (Name ? Ser.AtChecked(Name) : Ser.GetCurrentScope()).get_to(Value);
+    }
+}
+
+// glm vectors are JSON arrays, or their components back to back
+template<typename V>
+inline void SerializeGlm(Serializer& Ser, char const* Name, V const& Value) {
+    if (Ser.Format == SerdeFormat::Binary) {
+        for (int i = 0; i < V::length(); ++i) WritePrimitive(Ser, Value[i]);
+    } else if (Ser.Format == SerdeFormat::JsonStream) {
+        if (Name) Ser.Writer->BeginValue(Name);
+        Ser.Writer->BeginArray();
+        for (int i = 0; i < V::length(); ++i) {
+            Ser.Writer->BeginItem();
+            Ser.Writer->Scalar(Value[i]);
+            Ser.Writer->EndValue();
+        }
+        Ser.Writer->EndArray();
+        if (Name) Ser.Writer->EndValue();
+    } else {
+        nlohmann::json& Array = Name ? Ser.AtChecked(Name) : Ser.GetCurrentScope();
+        Array = nlohmann::json::array();
+        auto& Items = Array.get_ref<nlohmann::json::array_t&>();
+        Items.reserve(V::length());
+        for (int i = 0; i < V::length(); ++i) Items.emplace_back(Value[i]);
+    }
+}
+
+template<typename V>
+inline void DeserializeGlm(Deserializer& Ser, char const* Name, V& Value) {
+    if (Ser.Format == SerdeFormat::Binary) {
+        for (int i = 0; i < V::length(); ++i) ReadPrimitive(Ser, Value[i]);
+    } else if (Ser.Format == SerdeFormat::JsonStream) {
+        if (Name) Ser.Reader->BeginValue(Name);
+        Ser.Reader->BeginArray();
+        for (int i = 0; i < V::length(); ++i) {
+            if (!Ser.Reader->NextItem()) throw std::runtime_error("Too few components for a vector of " + std::to_string(V::length()));
+            Ser.Reader->Scalar(Value[i]);
+            Ser.Reader->EndValue();
+        }
+        if (Name) Ser.Reader->EndValue();
+    } else {
+        auto const& Array = Name ? Ser.AtChecked(Name) : Ser.GetCurrentScope();
+        for (int i = 0; i < V::length(); ++i) Array[i].get_to(Value[i]);
+    }
+}
+
 void Serialize(Serializer& Ser, char const* Name, SubclassOfBase const& Val);
 void Deserialize(Deserializer& Ser, char const* Name, SubclassOfBase& Val);
 void SerializeFields(Serializer& Ser, SubclassOfBase const& Val);
@@ -202,4 +592,320 @@ inline void Serialize(Serializer& Ser, char const* Name, std::optional<T> const&
 template<typename T>
 inline void DeserializeFields(Deserializer& Ser, std::optional<T>& Value);
 template<typename T>
-inline void Deserialize(Deserializer& Ser, char const* Name, std::optional<T>& Value);
\ No newline at end of file
+inline void Deserialize(Deserializer& Ser, char const* Name, std::optional<T>& Value);
+
+// Vectors of bulk types are stored as one block in Binary, copied in and out with memcpy
+// Scalar is the component type, swapped one at a time when the data has the other endianness
+template<typename T>
+struct BulkTraits {
+    static constexpr bool Enabled = false;
+    using Scalar = uint8_t;
+};
+
+template<typename T>
+requires (std::is_arithmetic_v<T> && !std::is_same_v<T, bool> && (std::is_integral_v<T> || sizeof(T) == 4 || sizeof(T) == 8))
+struct BulkTraits<T> {
+    static constexpr bool Enabled = true;
+    using Scalar = T;
+};
+
+template<glm::length_t L, typename T, glm::qualifier Q>
+struct BulkTraits<glm::vec<L, T, Q>> {
+    static constexpr bool Enabled = BulkTraits<T>::Enabled && sizeof(glm::vec<L, T, Q>) == L * sizeof(T);
+    using Scalar = T;
+};
+
+// Generated classes are bulk when every field is, all with the same Scalar and no padding between them
+template<typename T, typename First, typename... Rest>
+struct BulkFields {
+    using Scalar = typename BulkTraits<First>::Scalar;
+    static constexpr bool Enabled =
+        std::is_trivially_copyable_v<T> &&
+        BulkTraits<First>::Enabled && ((BulkTraits<Rest>::Enabled && std::is_same_v<typename BulkTraits<Rest>::Scalar, Scalar>) && ...) &&
+        sizeof(T) == (sizeof(First) + ... + sizeof(Rest));
+};
+
+template<typename T>
+inline constexpr bool IsBulkSerializable = BulkTraits<T>::Enabled;
+
+// Blocks start at a multiple of this in Binary
+inline constexpr size_t BulkAlignment = 16;
+
+// Low four bits are the size in bytes, the next two whether it's signed or floating point
+template<typename Scalar>
+constexpr uint8_t BulkTypeCode() {
+    return static_cast<uint8_t>(sizeof(Scalar) | (std::is_floating_point_v<Scalar> ? 0x20 : std::is_signed_v<Scalar> ? 0x10 : 0));
+}
+
+inline std::string BulkTypeName(uint8_t Code) {
+    return ((Code & 0x20) ? "f" : (Code & 0x10) ? "i" : "u") + std::to_string((Code & 0x0f) * 8);
+}
+
+template<typename Scalar>
+inline void ByteSwapBulk(void* Data, size_t Count) {
+    if constexpr (sizeof(Scalar) > 1) {
+        using Bits = std::conditional_t<sizeof(Scalar) == 2, uint16_t, std::conditional_t<sizeof(Scalar) == 4, uint32_t, uint64_t>>;
+        // Plain shifts over a flat array, which compilers turn into byte shuffles over whole vector registers
+        uint8_t* Bytes = static_cast<uint8_t*>(Data);
+        for (size_t i = 0; i < Count; ++i) {
+            Bits Word, Swapped = 0;
+            memcpy(&Word, Bytes + i * sizeof(Bits), sizeof(Bits));
+            for (size_t b = 0; b < sizeof(Bits); ++b) Swapped |= static_cast<Bits>((Word >> (b * 8)) & 0xff) << ((sizeof(Bits) - 1 - b) * 8);
+            memcpy(Bytes + i * sizeof(Bits), &Swapped, sizeof(Bits));
+        }
+    }
+}
+
+// The block is in the machine's byte order, the header says which
+// Binary format: type code (high bit set for big endian), components and count as varints, padding, then the block
+// JSON formats: {"Type":"f32","Components":3,"Count":N,"BigEndian":false,"Begin":Offset}
+template<typename T>
+inline void WriteBulk(Serializer& Ser, std::vector<T> const& Value) {
+    using Scalar = typename BulkTraits<T>::Scalar;
+    size_t const Components = sizeof(T) / sizeof(Scalar);
+    bool const BigEndian = std::endian::native == std::endian::big;
+
+    if (Ser.Format == SerdeFormat::Binary) {
+        Ser.Binary.push_back(BulkTypeCode<Scalar>() | (BigEndian ? 0x80 : 0));
+        Ser.WriteVarint(Components);
+        Ser.WriteVarint(Value.size());
+    }
+    Ser.Binary.resize((Ser.Binary.size() + BulkAlignment - 1) / BulkAlignment * BulkAlignment);
+    size_t const Begin = Ser.Binary.size();
+    if (!Value.empty()) Ser.WriteBytes(Value.data(), Value.size() * sizeof(T));
+
+    if (Ser.Format == SerdeFormat::JsonStream) {
+        Ser.Writer->Named("Type", BulkTypeName(BulkTypeCode<Scalar>()));
+        Ser.Writer->Named("Components", Components);
+        Ser.Writer->Named("Count", Value.size());
+        Ser.Writer->Named("BigEndian", BigEndian);
+        Ser.Writer->Named("Begin", Begin);
+    } else if (Ser.Format == SerdeFormat::Json) {
+        auto& Scope = Ser.GetCurrentScope();
+        Scope["Type"] = BulkTypeName(BulkTypeCode<Scalar>());
+        Scope["Components"] = Components;
+        Scope["Count"] = Value.size();
+        Scope["BigEndian"] = BigEndian;
+        Scope["Begin"] = Begin;
+    }
+}
+
+// Also reads {"Begin","Size"}, what byte vectors were written as before there were headers
+template<typename T>
+inline void ReadBulk(Deserializer& Ser, std::vector<T>& Value) {
+    using Scalar = typename BulkTraits<T>::Scalar;
+    uint8_t const Code = BulkTypeCode<Scalar>();
+    uint64_t Components = sizeof(T) / sizeof(Scalar), Count = 0, Begin = 0;
+    bool BigEndian = false;
+
+    if (Ser.Format == SerdeFormat::Binary) {
+        uint8_t Header;
+        Ser.ReadBytes(&Header, 1);
+        if ((Header & 0x7f) != Code) throw std::runtime_error("Expected an array of " + BulkTypeName(Code) + ", found " + BulkTypeName(Header & 0x7f) + " at byte " + std::to_string(Ser.BinaryOffset - 1));
+        BigEndian = Header & 0x80;
+        Components = Ser.ReadVarint();
+        Count = Ser.ReadVarint();
+        Begin = (Ser.BinaryOffset + BulkAlignment - 1) / BulkAlignment * BulkAlignment;
+    } else {
+        std::string Type;
+        bool HasCount = false, HasBegin = false, HasSize = false;
+        Ser.ForEachMember([&](std::string_view Key) {
+            if (Key == "Type") DeserializeFields(Ser, Type);
+            else if (Key == "Components") DeserializeFields(Ser, Components);
+            else if (Key == "Count") { DeserializeFields(Ser, Count); HasCount = true; }
+            else if (Key == "BigEndian") DeserializeFields(Ser, BigEndian);
+            else if (Key == "Begin") { DeserializeFields(Ser, Begin); HasBegin = true; }
+            else if (Key == "Size") { DeserializeFields(Ser, Count); HasSize = true; }
+        });
+        if (!HasBegin) Ser.MissingField("Begin");
+        if (Type.empty() && HasSize && sizeof(T) == 1) Type = BulkTypeName(Code);
+        else if (!HasCount) Ser.MissingField("Count");
+        if (Type != BulkTypeName(Code)) throw std::runtime_error("Expected an array of " + BulkTypeName(Code) + ", found " + (Type.empty() ? std::string("no type") : Type));
+    }
+
+    if (Components != sizeof(T) / sizeof(Scalar)) throw std::runtime_error("Expected " + std::to_string(sizeof(T) / sizeof(Scalar)) + " components per item, found " + std::to_string(Components));
+    if (Begin > Ser.Binary.size() || Count > (Ser.Binary.size() - Begin) / sizeof(T)) throw std::runtime_error("Array of " + std::to_string(Count) + " items runs past the end of the binary data");
+
+    Value.resize(Count);
+    if (Count) memcpy(Value.data(), Ser.Binary.data() + Begin, Count * sizeof(T));
+    if (BigEndian != (std::endian::native == std::endian::big)) ByteSwapBulk<Scalar>(Value.data(), Count * Components);
+    if (Ser.Format == SerdeFormat::Binary) Ser.BinaryOffset = Begin + Count * sizeof(T);
+}
+
+template<typename T, template<typename...> typename Template>
+inline constexpr bool IsSpecializationOf = false;
+
+template<template<typename...> typename Template, typename... Args>
+inline constexpr bool IsSpecializationOf<Template<Args...>, Template> = true;
+
+template<typename T>
+inline constexpr bool IsGlmVector = false;
+
+template<glm::length_t L, typename T, glm::qualifier Q>
+inline constexpr bool IsGlmVector<glm::vec<L, T, Q>> = true;
+
+enum class FieldKind { Bool, Integer, Float, String, Enum, Glm, Vector, Optional, SubclassOf, Class };
+
+template<typename T>
+constexpr FieldKind GetFieldKind() {
+    if constexpr (std::is_same_v<T, bool>) return FieldKind::Bool;
+    else if constexpr (std::is_integral_v<T>) return FieldKind::Integer;
+    else if constexpr (std::is_floating_point_v<T>) return FieldKind::Float;
+    else if constexpr (std::is_same_v<T, std::string>) return FieldKind::String;
+    else if constexpr (std::is_enum_v<T>) return FieldKind::Enum;
+    else if constexpr (IsGlmVector<T>) return FieldKind::Glm;
+    else if constexpr (IsSpecializationOf<T, std::vector>) return FieldKind::Vector;
+    else if constexpr (IsSpecializationOf<T, std::optional>) return FieldKind::Optional;
+    else if constexpr (std::is_base_of_v<SubclassOfBase, T>) return FieldKind::SubclassOf;
+    else return FieldKind::Class;
+}
+
+template<typename C, typename T>
+struct FieldInfo {
+    using ClassType = C;
+    using Type = T;
+
+    char const* Name;
+    T C::* Member;
+    size_t Offset;
+    FieldKind Kind;
+};
+
+template<typename C, typename T>
+constexpr FieldInfo<C, T> MakeField(char const* Name, T C::* Member, size_t Offset) {
+    return { Name, Member, Offset, GetFieldKind<T>() };
+}
+
+// Specialized for every reflected class, Fields is a tuple of FieldInfo in declaration order
+template<typename T>
+struct FieldTable;
+
+template<typename T>
+concept Reflected = requires { FieldTable<T>::Fields; };
+
+template<Reflected T>
+inline constexpr size_t FieldCount = std::tuple_size_v<std::remove_const_t<decltype(FieldTable<T>::Fields)>>;
+
+// Calls Fn(Field) with each FieldInfo of T, unrolled at compile time
+template<Reflected T, typename F>
+constexpr void ForEachField(F&& Fn) {
+    std::apply([&](auto const&... Fields) { (Fn(Fields), ...); }, FieldTable<T>::Fields);
+}
+
+// Calls Fn(Field, Value) for each field of Object, Value is const when Object is
+template<typename T, typename F>
+requires Reflected<std::remove_const_t<T>>
+constexpr void ForEachField(T& Object, F&& Fn) {
+    std::apply([&](auto const&... Fields) { (Fn(Fields, Object.*Fields.Member), ...); }, FieldTable<std::remove_const_t<T>>::Fields);
+}
+
+// What SubclassOf needs to serialize and deserialize one type
+template<typename T>
+void SerializeSubclassFields(Serializer& Ser, std::any const& Value) {
+    SerializeFields(Ser, std::any_cast<T const&>(Value));
+}
+
+template<typename T>
+void DeserializeSubclassFields(Deserializer& Ser, SubclassOfBase& Value) {
+    T Temp;
+    DeserializeFields(Ser, Temp);
+    Value = SubclassOf<T>(Temp);
+}
+
+// FNV-1a
+constexpr uint64_t SubclassTypeHash(std::string_view Name) {
+    uint64_t Hash = 14695981039346656037ull;
+    for (char C : Name) {
+        Hash ^= static_cast<uint8_t>(C);
+        Hash *= 1099511628211ull;
+    }
+    return Hash;
+}
+
+struct SubclassTableEntry {
+    uint64_t Hash;    // Filled in by MakeSubclassTable
+    char const* Name; // Null for an empty slot
+    std::type_info const* Type;
+    void (*SerializeFields)(Serializer& Ser, std::any const& Value);
+    void (*DeserializeFields)(Deserializer& Ser, SubclassOfBase& Value);
+};
+
+// Power of two at least twice the number of types, so probes stay short and always reach an empty slot
+constexpr size_t SubclassTableSize(size_t Count) {
+    size_t Size = 1;
+    while (Size < Count * 2) Size *= 2;
+    return Size;
+}
+
+// Open addressing by name hash with linear probing, laid out at compile time
+template<size_t N>
+constexpr std::array<SubclassTableEntry, SubclassTableSize(N)> MakeSubclassTable(std::array<SubclassTableEntry, N> const& Entries) {
+    std::array<SubclassTableEntry, SubclassTableSize(N)> Table {};
+    size_t const Mask = Table.size() - 1;
+    for (SubclassTableEntry Entry : Entries) {
+        Entry.Hash = SubclassTypeHash(Entry.Name);
+        size_t Slot = Entry.Hash & Mask;
+        while (Table[Slot].Name) Slot = (Slot + 1) & Mask;
+        Table[Slot] = Entry;
+    }
+    return Table;
+}
+
+template<size_t Size>
+constexpr SubclassTableEntry const* FindSubclass(std::array<SubclassTableEntry, Size> const& Table, std::string_view Name) {
+    uint64_t const Hash = SubclassTypeHash(Name);
+    for (size_t Slot = Hash & (Size - 1); Table[Slot].Name; Slot = (Slot + 1) & (Size - 1)) {
+        if (Table[Slot].Hash == Hash && Name == Table[Slot].Name) return &Table[Slot];
+    }
+    return nullptr;
+}
+
+// type_info can't be hashed at compile time, so the table is indexed by type on first use
+template<size_t Size>
+std::unordered_map<std::type_index, SubclassTableEntry const*> IndexSubclassTable(std::array<SubclassTableEntry, Size> const& Table) {
+    std::unordered_map<std::type_index, SubclassTableEntry const*> ByType;
+    ByType.reserve(Size / 2);
+    for (SubclassTableEntry const& Entry : Table) {
+        if (Entry.Name) ByType.emplace(*Entry.Type, &Entry);
+    }
+    return ByType;
+}
+
+// Without a main impl, each generated file registers its types here during static initialization
+// The SubclassOf implementations in the generated files look types up by name or type instead of a table in the main impl
+class SubclassRegistry {
+public:
+    struct Entry {
+        std::string Name;
+        void (*SerializeFields)(Serializer& Ser, std::any const& Value);
+        void (*DeserializeFields)(Deserializer& Ser, SubclassOfBase& Value);
+    };
+
+    static SubclassRegistry& Get() {
+        static SubclassRegistry Registry;
+        return Registry;
+    }
+
+    template<typename T>
+    bool Register(char const* Name) {
+        Entry& Registered = ByName[Name];
+        Registered.Name = Name;
+        Registered.SerializeFields = &SerializeSubclassFields<T>;
+        Registered.DeserializeFields = &DeserializeSubclassFields<T>;
+        ByType[std::type_index(typeid(T))] = &Registered;
+        return true;
+    }
+
+    Entry const* Find(std::string const& Name) const {
+        auto const Found = ByName.find(Name);
+        return Found == ByName.end() ? nullptr : &Found->second;
+    }
+
+    Entry const* Find(std::type_info const& Type) const {
+        auto const Found = ByType.find(std::type_index(Type));
+        return Found == ByType.end() ? nullptr : Found->second;
+    }
+private:
+    std::unordered_map<std::string, Entry> ByName;
+    std::unordered_map<std::type_index, Entry const*> ByType;
+};
\ No newline at end of file
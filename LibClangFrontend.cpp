@@ -0,0 +1,193 @@
+#include "LibClangFrontend.hpp"
+
+#include <fstream>
+
+#ifdef AR_USE_LIBCLANG
+#include <clang-c/Index.h>
+
+namespace {
+    std::string ToString(CXString Str) {
+        char const* CStr = clang_getCString(Str);
+        std::string Res = CStr ? CStr : "";
+        clang_disposeString(Str);
+        return Res;
+    }
+
+    // One index per worker thread, reused for every TU that worker parses
+    CXIndex GetThreadIndex() {
+        struct IndexHolder {
+            CXIndex Index = clang_createIndex(0, 0);
+            ~IndexHolder() { clang_disposeIndex(Index); }
+        };
+        thread_local IndexHolder Holder;
+        return Holder.Index;
+    }
+
+    struct VisitState {
+        ASTTree* Tree;
+        uint32_t Parent;
+        ProjectFileFilter* Filter = nullptr;
+        int TemplateParamIndex = 0;
+    };
+
+    // Only records and templates directly in a namespace are filtered, like in the textual dump
+    bool IsSkipped(CXCursor Cursor, VisitState const& State) {
+        TagType const ParentTag = (*State.Tree)[State.Parent].Tag;
+        if (ParentTag != TagType::TranslationUnitDecl && ParentTag != TagType::NamespaceDecl) return false;
+
+        CXSourceLocation const Location = clang_getCursorLocation(Cursor);
+        if (clang_Location_isInSystemHeader(Location)) return true;
+
+        CXFile File = nullptr;
+        clang_getExpansionLocation(Location, &File, nullptr, nullptr, nullptr);
+        return !File || !State.Filter->Contains(ToString(clang_getFileName(File)));
+    }
+
+    uint32_t AddNode(VisitState const& State, uint32_t Parent, TagType Tag, std::string const& Line) {
+        return State.Tree->AddNode(Parent, Tag, (*State.Tree)[Parent].Indent + 2, Line);
+    }
+
+    CXChildVisitResult VisitCursor(CXCursor Cursor, CXCursor, CXClientData Data);
+
+    void VisitChildren(CXCursor Cursor, VisitState const& Parent, uint32_t Node) {
+        VisitState State { Parent.Tree, Node, Parent.Filter };
+        clang_visitChildren(Cursor, VisitCursor, &State);
+    }
+
+    // Mirrors the text of the textual dump lines GeneratorContext looks for
+    CXChildVisitResult VisitCursor(CXCursor Cursor, CXCursor, CXClientData Data) {
+        VisitState& State = *static_cast<VisitState*>(Data);
+        std::string const Name = ToString(clang_getCursorSpelling(Cursor));
+
+        switch (clang_getCursorKind(Cursor)) {
+        case CXCursor_Namespace:
+            VisitChildren(Cursor, State, AddNode(State, State.Parent, TagType::NamespaceDecl, Name));
+            break;
+        case CXCursor_ClassDecl:
+        case CXCursor_StructDecl:
+            if (clang_isCursorDefinition(Cursor) && !IsSkipped(Cursor, State)) {
+                std::string const Keyword = (clang_getCursorKind(Cursor) == CXCursor_ClassDecl) ? "class " : "struct ";
+                VisitChildren(Cursor, State, AddNode(State, State.Parent, TagType::CXXRecordDecl, Keyword + Name + " definition"));
+            }
+            break;
+        case CXCursor_ClassTemplate: {
+            // The dump nests the pattern record inside the template, libclang merges them into one cursor
+            if (!clang_isCursorDefinition(Cursor) || IsSkipped(Cursor, State)) break;
+
+            uint32_t const Template = AddNode(State, State.Parent, TagType::ClassTemplateDecl, Name);
+            VisitState TemplateState { State.Tree, Template, State.Filter };
+            clang_visitChildren(Cursor, [](CXCursor Child, CXCursor, CXClientData Data) {
+                CXCursorKind const Kind = clang_getCursorKind(Child);
+                if (Kind == CXCursor_TemplateTypeParameter || Kind == CXCursor_NonTypeTemplateParameter || Kind == CXCursor_TemplateTemplateParameter) {
+                    return VisitCursor(Child, Child, Data);
+                }
+                return CXChildVisit_Continue;
+            }, &TemplateState);
+
+            std::string const Keyword = (clang_getTemplateCursorKind(Cursor) == CXCursor_ClassDecl) ? "class " : "struct ";
+            uint32_t const Record = AddNode(State, Template, TagType::CXXRecordDecl, Keyword + Name + " definition");
+            VisitState RecordState { State.Tree, Record, State.Filter };
+            clang_visitChildren(Cursor, [](CXCursor Child, CXCursor, CXClientData Data) {
+                CXCursorKind const Kind = clang_getCursorKind(Child);
+                if (Kind == CXCursor_TemplateTypeParameter || Kind == CXCursor_NonTypeTemplateParameter || Kind == CXCursor_TemplateTemplateParameter) {
+                    return CXChildVisit_Continue;
+                }
+                return VisitCursor(Child, Child, Data);
+            }, &RecordState);
+            break;
+        }
+        case CXCursor_TemplateTypeParameter:
+            AddNode(State, State.Parent, TagType::TemplateTypeParmDecl, "typename depth 0 index " + std::to_string(State.TemplateParamIndex++) + " " + Name);
+            break;
+        case CXCursor_NonTypeTemplateParameter: {
+            std::string const Type = ToString(clang_getTypeSpelling(clang_getCursorType(Cursor)));
+            AddNode(State, State.Parent, TagType::NonTypeTemplateParmDecl, "'" + Type + "' depth 0 index " + std::to_string(State.TemplateParamIndex++) + " " + Name);
+            break;
+        }
+        case CXCursor_TemplateTemplateParameter: {
+            uint32_t const Param = AddNode(State, State.Parent, TagType::TemplateTemplateParmDecl, "template depth 0 index " + std::to_string(State.TemplateParamIndex++) + " " + Name);
+            VisitChildren(Cursor, State, Param);
+            break;
+        }
+        case CXCursor_FieldDecl: {
+            std::string const Type = ToString(clang_getTypeSpelling(clang_getCursorType(Cursor)));
+            AddNode(State, State.Parent, TagType::FieldDecl, Name + " '" + Type + "'");
+            break;
+        }
+        case CXCursor_EnumDecl: {
+            std::string const Underlying = ToString(clang_getTypeSpelling(clang_getEnumDeclIntegerType(Cursor)));
+            std::string const Keyword = clang_EnumDecl_isScoped(Cursor) ? "class " : "";
+            AddNode(State, State.Parent, TagType::EnumDecl, Keyword + Name + " '" + Underlying + "'");
+            break;
+        }
+        case CXCursor_CXXBaseSpecifier: {
+            std::string const Type = ToString(clang_getTypeSpelling(clang_getCursorType(Cursor)));
+            CX_CXXAccessSpecifier const Access = clang_getCXXAccessSpecifier(Cursor);
+            if (Access == CX_CXXPublic) AddNode(State, State.Parent, TagType::Public, "'" + Type + "'");
+            else if (Access == CX_CXXPrivate) AddNode(State, State.Parent, TagType::Private, "'" + Type + "'");
+            break;
+        }
+        default:
+            break;
+        }
+
+        return CXChildVisit_Continue;
+    }
+}
+
+ASTTree LoadASTNodesLibClang(std::filesystem::path const& ParsePath, std::vector<std::filesystem::path> const& Includes, std::filesystem::path const& Pch, std::filesystem::path const& DepFile, std::set<std::string> const& ProjectFiles, bool Silent) {
+    std::vector<std::string> Args = { "-x", "c++", "-std=c++20", "-DAUTOREFLECT_GENERATING", "-I" + std::string(AR_INCLUDE_DIR) };
+    for (auto const& Include : Includes) {
+        Args.push_back("-I" + Include.string());
+    }
+    if (!Pch.empty()) {
+        Args.push_back("-include-pch");
+        Args.push_back(Pch.string());
+    }
+
+    std::vector<char const*> ArgPtrs;
+    for (auto const& Arg : Args) ArgPtrs.push_back(Arg.c_str());
+
+    if (!Silent) Log(ParsePath, "Parsing with libclang");
+
+    // Function bodies never contain anything that gets reflected
+    unsigned const Options = CXTranslationUnit_SkipFunctionBodies | CXTranslationUnit_KeepGoing;
+
+    CXTranslationUnit TU = nullptr;
+    CXErrorCode Error = clang_parseTranslationUnit2(GetThreadIndex(), ParsePath.string().c_str(), ArgPtrs.data(), static_cast<int>(ArgPtrs.size()), nullptr, 0, Options, &TU);
+    if (Error != CXError_Success || !TU) {
+        throw std::runtime_error("libclang failed to parse " + ParsePath.string());
+    }
+    CallOnDtor DisposeTU([TU]() { clang_disposeTranslationUnit(TU); });
+
+    ASTTree Tree;
+    ProjectFileFilter Filter(ProjectFiles);
+    VisitState RootState { &Tree, Tree.AddNode(0, TagType::TranslationUnitDecl, 0, ""), &Filter };
+    clang_visitChildren(clang_getTranslationUnitCursor(TU), VisitCursor, &RootState);
+
+    std::vector<std::string> Dependencies;
+    clang_getInclusions(TU, [](CXFile Included, CXSourceLocation*, unsigned, CXClientData Data) {
+        static_cast<std::vector<std::string>*>(Data)->push_back(ToString(clang_getFileName(Included)));
+    }, &Dependencies);
+
+    std::ofstream Deps(DepFile);
+    Deps << EscapeDepfilePath(ParsePath.string()) << ".o:";
+    for (auto const& Dep : Dependencies) {
+        Deps << " \\\n  " << EscapeDepfilePath(Dep);
+    }
+    Deps << "\n";
+
+    return Tree;
+}
+
+bool IsLibClangAvailable() { return true; }
+
+#else
+
+ASTTree LoadASTNodesLibClang(std::filesystem::path const&, std::vector<std::filesystem::path> const&, std::filesystem::path const&, std::filesystem::path const&, std::set<std::string> const&, bool) {
+    throw std::runtime_error("AutoReflect was built without libclang, reconfigure with -DAR_USE_LIBCLANG=ON");
+}
+
+bool IsLibClangAvailable() { return false; }
+
+#endif
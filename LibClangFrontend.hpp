@@ -0,0 +1,12 @@
+#pragma once
+
+#include "Parsing.hpp"
+
+// Builds the same tree LoadASTNodes produces, but by visiting clang's AST in-process through libclang
+// Lines are synthesized in the format of the textual dump, so GeneratorContext works unchanged
+// Writes the TU's dependencies to DepFile in the same format as clang -MD
+// Declarations outside ProjectFiles are skipped the same way LoadASTNodes skips them
+// Only available when built with AR_USE_LIBCLANG, throws otherwise
+ASTTree LoadASTNodesLibClang(std::filesystem::path const& ParsePath, std::vector<std::filesystem::path> const& Includes, std::filesystem::path const& Pch, std::filesystem::path const& DepFile, std::set<std::string> const& ProjectFiles, bool Silent);
+
+bool IsLibClangAvailable();
@@ -1,126 +1,270 @@
 #include "Parsing.hpp"
+#include "Trace.hpp"
 
-#include <sstream>
+#include <fstream>
+#include <optional>
 
-std::vector<std::string> SplitForTemplate(std::string const& Val) {
-    std::vector<std::string> result;
-    result.reserve(5);
-    std::stringstream ss (Val);
-    std::string item;
+namespace {
+    bool IsIdentifierChar(char C) {
+        return (C >= 'a' && C <= 'z') || (C >= 'A' && C <= 'Z') || (C >= '0' && C <= '9') || C == '_';
+    }
+
+    bool IsFieldTypeChar(char C) {
+        switch (C) {
+        case ':': case '<': case '>': case ',': case ' ': case '*': case '&': case '[': case ']':
+            return true;
+        default:
+            return IsIdentifierChar(C);
+        }
+    }
+}
+
+std::optional<std::string_view> ScanClassDefinition(std::string_view Line) {
+    constexpr std::string_view Definition = " definition";
+
+    for (size_t i = Line.find("class "); i != std::string_view::npos; i = Line.find("class ", i + 1)) {
+        size_t const Begin = i + 6;
+        size_t End = Begin;
+        while (End < Line.size() && IsIdentifierChar(Line[End])) ++End;
+
+        if (End > Begin && Line.substr(End, Definition.size()) == Definition) {
+            return Line.substr(Begin, End - Begin);
+        }
+    }
 
-    while (std::getline (ss, item, ' ')) {
-        result.push_back (item);
+    return std::nullopt;
+}
+
+bool ScanField(std::string_view Line, std::string_view& Name, std::string_view& Type) {
+    // A match always starts at the beginning of a run of identifier characters, so try each run in order
+    size_t i = 0;
+    while (i < Line.size()) {
+        if (!IsIdentifierChar(Line[i])) {
+            ++i;
+            continue;
+        }
+
+        size_t const NameBegin = i;
+        while (i < Line.size() && IsIdentifierChar(Line[i])) ++i;
+        size_t const NameEnd = i;
+
+        if (NameEnd + 1 < Line.size() && Line[NameEnd] == ' ' && Line[NameEnd + 1] == '\'') {
+            size_t const TypeBegin = NameEnd + 2;
+            size_t TypeEnd = TypeBegin;
+            while (TypeEnd < Line.size() && IsFieldTypeChar(Line[TypeEnd])) ++TypeEnd;
+
+            if (TypeEnd > TypeBegin && TypeEnd < Line.size() && Line[TypeEnd] == '\'') {
+                Name = Line.substr(NameBegin, NameEnd - NameBegin);
+                Type = Line.substr(TypeBegin, TypeEnd - TypeBegin);
+                return true;
+            }
+        }
     }
 
-    return result;
+    return false;
 }
 
-bool GetTemplateParams(std::string const& Line, std::string& Type, std::string& Name, bool& HasType) {
-    auto Sections = SplitForTemplate(Line);
-    int NumDots = 0;
-    int NumVars = 0;
-    if (Sections.back()[0] >= '0' && Sections.back()[0] <= '9') {
-        Name = "";
+bool ScanEnum(std::string_view Line, std::string_view& Name, std::string_view& Underlying) {
+    if (Line.empty() || Line.back() != '\'') return false;
+
+    size_t const ClassIndex = Line.find("class ");
+    if (ClassIndex == std::string_view::npos) return false;
+
+    std::string_view Rest = Line.substr(ClassIndex + 6);
+    size_t const NextSpaceIndex = Rest.find(' ');
+    if (NextSpaceIndex == std::string_view::npos) return false;
+
+    Rest.remove_suffix(1); // Remove the '
+    size_t const LastQuoteIndex = Rest.find_last_of('\'');
+    if (LastQuoteIndex == std::string_view::npos) return false;
+
+    Name = Rest.substr(0, NextSpaceIndex);
+    Underlying = Rest.substr(LastQuoteIndex + 1);
+    return true;
+}
+
+bool GetTemplateParams(std::string_view Line, std::string_view& Type, std::string_view& Name) {
+    // Only the last few space separated sections matter, a trailing space doesn't start a new one
+    constexpr size_t Kept = 8;
+    std::string_view Sections[Kept];
+    size_t NumSections = 0;
+
+    size_t Begin = 0;
+    while (Begin < Line.size()) {
+        size_t End = Line.find(' ', Begin);
+        if (End == std::string_view::npos) End = Line.size();
+        Sections[NumSections++ % Kept] = Line.substr(Begin, End - Begin);
+        Begin = End + 1;
+    }
+
+    auto FromBack = [&](size_t i) -> std::string_view { return Sections[(NumSections - 1 - i) % Kept]; };
+    if (NumSections == 0) return false;
+
+    size_t NumDots = 0;
+    size_t NumVars = 0;
+    std::string_view const Last = FromBack(0);
+    if (!Last.empty() && Last[0] >= '0' && Last[0] <= '9') {
+        Name = std::string_view();
     } else {
         NumVars = 1;
-        Name = Sections.back();
+        Name = Last;
     }
-    if (Sections[Sections.size() - 1 - NumVars][0] == '.') {
+    if (NumSections <= NumVars) return false;
+    std::string_view const BeforeName = FromBack(NumVars);
+    if (!BeforeName.empty() && BeforeName[0] == '.') {
         NumDots = 1;
     }
-    
-    Type = Sections[Sections.size() - NumVars - NumDots - 5];
+
+    size_t const TypeIndex = NumVars + NumDots + 4;
+    if (TypeIndex >= NumSections) return false;
+    Type = FromBack(TypeIndex);
     return true;
 }
 
-std::vector<std::string> GetAllHeaders(std::filesystem::path const& Path, std::vector<std::filesystem::path> const& Includes, bool Silent) {
-    std::string GetHeadersCommand
-#ifdef _WIN32
-    = "cmd /c \"clang -std=c++20 -M";
-    
-    for (auto const& Include : Includes) {
-        GetHeadersCommand += " -I\"" + Include.string() + "\"";
-    }
-    
-    GetHeadersCommand += " " + Path.string()
-    + " 2>NUL\"";
-#else
-    = "clang -std=c++20 -M";
-    
-    for (auto const& Include : Includes) {
-        GetHeadersCommand += " -I\"" + Include.string() + "\"";
-    }
+std::vector<std::string> GetAllHeaders(std::filesystem::path const& DepFilePath) {
+    std::vector<std::string> Headers;
 
-    GetHeadersCommand += " " + Path.string()
-    + " 2>/dev/null";
-#endif
+    // Skip the "target:" part, everything after it is a whitespace separated list of paths
+    // Spaces inside paths are escaped with a backslash, and a backslash at the end of a line continues it
+    bool FoundTarget = false;
+    std::string Current;
+    auto EndPath = [&]() {
+        if (FoundTarget && !Current.empty()) Headers.push_back(Current);
+        Current.clear();
+    };
+
+    bool const Opened = ForEachLineInFile(DepFilePath, [&](std::string_view Line) {
+        for (size_t i = 0; i < Line.size(); ++i) {
+            char const C = Line[i];
+            if (C == '\\' && i + 1 < Line.size()) {
+                char const Next = Line[i + 1];
+                if (Next == '\r') {
+                    ++i;
+                } else if (Next == ' ' || Next == '#' || Next == '\\') {
+                    Current += Next;
+                    ++i;
+                    continue;
+                } else {
+                    Current += C;
+                    continue;
+                }
+            } else if (C == '\\') {
+                // Line continuation
+            } else if (C == '$' && i + 1 < Line.size() && Line[i + 1] == '$') {
+                Current += '$';
+                ++i;
+                continue;
+            } else if (C == ':' && !FoundTarget && (i + 1 >= Line.size() || Line[i + 1] == ' ')) {
+                FoundTarget = true;
+                Current.clear();
+                continue;
+            } else if (C != ' ' && C != '\t' && C != '\r') {
+                Current += C;
+                continue;
+            }
 
-    if (!Silent) Log(Path, "Clang command: " + GetHeadersCommand);
+            EndPath();
+        }
+        EndPath();
+    });
 
-    std::unique_ptr<FILE, decltype(&PCLOSE)> Pipe(POPEN(GetHeadersCommand.c_str(), "r"), PCLOSE);
-    if (!Pipe) {
-        throw std::runtime_error("popen() failed!");
+    if (!Opened) {
+        throw std::runtime_error("Could not read dependency file " + DepFilePath.string());
     }
 
-    std::vector<std::string> Headers;
+    return Headers;
+}
 
-    constexpr size_t LineSize = 1024 * 16;
-    char* LineData = new char[LineSize];
-    memset(LineData, 0, LineSize);
-    bool First = true;
-    while (fgets(LineData, LineSize, Pipe.get())) {
-        if (First || LineSize < 2) {
-            First = false;
-            continue;
-        }
-        std::string Line = LineData + 2;
+ProjectFileFilter::ProjectFileFilter(std::set<std::string> const& ProjectFiles)
+    : ProjectFiles(ProjectFiles)
+{ }
+
+bool ProjectFileFilter::Contains(std::string_view Path) {
+    auto Found = Spellings.find(Path);
+    if (Found == Spellings.end()) {
+        std::error_code Ec;
+        std::filesystem::path Canonical = std::filesystem::weakly_canonical(std::filesystem::path(Path), Ec);
+        bool const InProject = !Ec && ProjectFiles.find(Canonical.string()) != ProjectFiles.end();
+        Found = Spellings.emplace(std::string(Path), InProject).first;
+    }
+    return Found->second;
+}
 
-        // May end with trailing space trailing backslash and newline
-        Line.pop_back();
-        if (Line.back() == '\\') {
-            Line.pop_back();
-            Line.pop_back();
-        }
+bool ProjectFileFilter::TrackDumpLine(std::string_view Line) {
+    // Locations come before any quoted names or types, which could contain anything
+    size_t const End = std::min(Line.find_first_of("'\""), Line.size());
 
-        // And apparently, spaces can also be delimiter not just newlines
-        while (true) {
-            // Find next space, take substring up to that, or the whole thing if no space
-            size_t SpacePos = Line.find(' ');
-            if (SpacePos == std::string::npos) {
-                Headers.push_back(Line);
-                break;
-            } else {
-                Headers.push_back(Line.substr(0, SpacePos));
-                Line = Line.substr(SpacePos + 1);
-            }
+    std::optional<bool> First;
+    for (size_t i = Line.find(':'); i < End; i = Line.find(':', i + 1)) {
+        size_t const Start = Line.find_last_of(" <=", i) + 1;
+        std::string_view const Prefix = Line.substr(Start, i - Start);
+
+        // Either "col:N" or "<file or line>:N:N"
+        if (Prefix == "col") {
+            if (!First) First = CurrentInProject;
+            continue;
         }
 
-        //Log(Path, "Header: " + std::string(LineData));
-        Headers.push_back(Line);
+        size_t j = i + 1;
+        while (j < End && Line[j] >= '0' && Line[j] <= '9') ++j;
+        if (j == i + 1 || j >= End || Line[j] != ':') continue;
+        size_t k = j + 1;
+        while (k < End && Line[k] >= '0' && Line[k] <= '9') ++k;
+        if (k == j + 1) continue;
+
+        if (Prefix != "line") CurrentInProject = Contains(Prefix);
+        if (!First) First = CurrentInProject;
+        i = k - 1;
     }
-    delete[] LineData;
 
-    return Headers;
+    return First ? *First : CurrentInProject;
+}
+
+ASTTree::ASTTree() {
+    Nodes.emplace_back();
 }
 
-void DeleteNode(ASTPtr Node) {
-    if (!Node) return;
+std::string_view ASTTree::StoreLine(std::string_view Line) {
+    if (Line.empty()) return std::string_view();
+
+    // Lines longer than a chunk get a chunk of their own
+    if (Line.size() > ChunkSize) {
+        Chunks.push_back(std::make_unique<char[]>(Line.size()));
+        memcpy(Chunks.back().get(), Line.data(), Line.size());
+        return std::string_view(Chunks.back().get(), Line.size());
+    }
 
-    for (auto const& Child : Node->Children) {
-        DeleteNode(Child);
+    if (ChunkUsed + Line.size() > ChunkSize) {
+        Chunks.push_back(std::make_unique<char[]>(ChunkSize));
+        Chunk = Chunks.back().get();
+        ChunkUsed = 0;
     }
 
-    // Find the node in the parent's children
-    auto const& Parent = Node->Parent;
-    auto const& Children = Parent->Children;
-    auto const& It = std::find(Children.begin(), Children.end(), Node);
-    if (It == Children.end()) {
-        throw std::runtime_error("Node not found in parent's children");
+    char* Dest = Chunk + ChunkUsed;
+    memcpy(Dest, Line.data(), Line.size());
+    ChunkUsed += Line.size();
+    return std::string_view(Dest, Line.size());
+}
+
+uint32_t ASTTree::AddNode(uint32_t Parent, TagType Tag, int Indent, std::string_view Line) {
+    uint32_t const Index = static_cast<uint32_t>(Nodes.size());
+
+    ASTNode Node;
+    Node.Indent = Indent;
+    Node.Tag = Tag;
+    Node.Line = StoreLine(Line);
+    Node.Parent = Parent;
+    Nodes.push_back(Node);
+
+    ASTNode& ParentNode = Nodes[Parent];
+    if (ParentNode.LastChild == ASTNode::None) {
+        ParentNode.FirstChild = Index;
+    } else {
+        Nodes[ParentNode.LastChild].NextSibling = Index;
     }
+    ParentNode.LastChild = Index;
 
-    // Remove the node from the parent's children
-    Parent->Children.erase(It);
-    Node->Parent = nullptr;
+    return Index;
 }
 
 bool StartsWith(uint32_t& OutSize, char const* Line, size_t LineSize, char const* Match, uint32_t const& MatchSize) {
@@ -148,85 +292,95 @@ TagType BeginsWithValidTag(char const* Line, size_t LineSize, uint32_t& End) {
     return TagType::INVALID;
 }
 
-ASTPtr LoadASTNodes(std::filesystem::path const& ASTFile, std::vector<std::filesystem::path> const& Includes, bool Silent) {
-    const ASTPtr Root = std::make_shared<ASTNode>();
-    Root->Indent = 0;
-    ASTPtr CurrentScope = Root;
+ASTTree LoadASTNodes(std::filesystem::path const& ASTFile, std::vector<std::filesystem::path> const& Includes, std::filesystem::path const& Pch, std::filesystem::path const& DepFile, std::set<std::string> const& ProjectFiles, bool Silent) {
+    ASTTree Tree;
+    uint32_t CurrentScope = 0;
 
-    ClangASTLinesPiped(ASTFile, Includes, [&](char const* CurrentLine, size_t LineSize) {
-        size_t Indent = 0;
-        char c = CurrentLine[0];
-        if (c == '-' || c == '|' || c == ' ' || c == '`') {
-            while (c == '-' || c == '|' || c == ' ' || c == '`') {
-                c = CurrentLine[Indent++];
-            }
-            --Indent;
-        }
+    ProjectFileFilter Filter(ProjectFiles);
+
+    // Lines deeper than this belong to a subtree that is being skipped
+    int SkipIndent = -1;
+
+    TraceScope Scope("ClangASTDump", ASTFile);
+    int64_t BytesRead = 0;
+
+    ClangASTLinesPiped(ASTFile, Includes, Pch, DepFile, [&](std::string_view Line) {
+        BytesRead += static_cast<int64_t>(Line.size()) + 1;
+
+        size_t const Indent = Line.find_first_not_of("-| `");
+        if (Indent == std::string_view::npos) return;
+
+        char const* CurrentLine = Line.data();
+        size_t const LineSize = Line.size();
+
+        // Skipped lines still move the current file
+        bool const InProject = Filter.TrackDumpLine(std::string_view(CurrentLine + Indent, LineSize - Indent));
+
+        if (SkipIndent >= 0 && static_cast<int>(Indent) > SkipIndent) return;
+        SkipIndent = -1;
 
         // Pop if we are at a lower or equal indent level
-        while (Indent <= CurrentScope->Indent && CurrentScope != Root) {
-            CurrentScope = CurrentScope->Parent;
+        while (CurrentScope != 0 && static_cast<int>(Indent) <= Tree[CurrentScope].Indent) {
+            CurrentScope = Tree[CurrentScope].Parent;
         }
 
-        ASTPtr ToAdd = std::make_shared<ASTNode>();
-        ToAdd->Parent = CurrentScope;
-        ToAdd->Indent = static_cast<int>(Indent);
-
         uint32_t OutSize;
         TagType Tag = BeginsWithValidTag(CurrentLine + Indent, LineSize - Indent, OutSize);
-        ToAdd->Tag = Tag;
-        if (Tag != TagType::INVALID) {
-            ToAdd->Line = CurrentLine + Indent + OutSize;
-            CurrentScope->Children.push_back(ToAdd);
+
+        // Children of unrecognized nodes were never reachable, so they aren't materialized either
+        bool const TopLevel = CurrentScope == 0 || Tree[CurrentScope].Tag == TagType::TranslationUnitDecl || Tree[CurrentScope].Tag == TagType::NamespaceDecl;
+        bool const AlwaysKept = Tag == TagType::TranslationUnitDecl || Tag == TagType::NamespaceDecl || Tag == TagType::EnumDecl;
+        if (Tag == TagType::INVALID || (TopLevel && !AlwaysKept && !InProject)) {
+            SkipIndent = static_cast<int>(Indent);
+            return;
         }
 
-        CurrentScope = ToAdd;
+        CurrentScope = Tree.AddNode(CurrentScope, Tag, static_cast<int>(Indent), std::string_view(CurrentLine + Indent + OutSize, LineSize - Indent - OutSize));
     }, Silent);
 
-    if (Root->Children.size() < 1) return nullptr;
-    Root->Children[0]->Parent = nullptr;
-    return Root->Children[0];
+    Scope.AddArg("BytesRead", BytesRead);
+    TraceRecorder::AddCounter("ClangBytesRead", BytesRead);
+
+    return Tree;
 }
 
-void ClangASTLinesPiped(std::filesystem::path const& ParsePath, std::vector<std::filesystem::path> const& Includes, std::function<void(const char*, size_t)> const& Func, bool Silent) {
-    std::string ClangASTCommand
-#ifdef _WIN32
-    = "cmd /c \"clang -std=c++20 -Xclang -ast-dump -fsyntax-only -fno-color-diagnostics -I"
-    + std::string(AR_INCLUDE_DIR);
-    
-    for (auto const& Include : Includes) {
-        ClangASTCommand += " -I\"" + Include.string() + "\"";
-    }
-    
-    ClangASTCommand += " " + ParsePath.string()
-    + " 2>NUL\"";
-#else
-    = "clang -std=c++20 -Xclang -ast-dump -fsyntax-only -fno-color-diagnostics -I"
-    + std::string(AR_INCLUDE_DIR);
-    
+std::vector<std::string> GetClangCommonArgs(std::vector<std::filesystem::path> const& Includes) {
+    std::vector<std::string> Args = {
+        "clang", "-std=c++20", "-fno-color-diagnostics", "-DAUTOREFLECT_GENERATING",
+        "-I" + std::string(AR_INCLUDE_DIR)
+    };
+
     for (auto const& Include : Includes) {
-        ClangASTCommand += " -I\"" + Include.string() + "\"";
+        Args.push_back("-I" + Include.string());
     }
 
-    ClangASTCommand += " " + ParsePath.string()
-    + " 2>/dev/null";
-#endif
+    return Args;
+}
 
-    if (!Silent) Log(ParsePath, "Clang command: " + ClangASTCommand);
+std::vector<std::string> GetClangASTArgs(std::filesystem::path const& ParsePath, std::vector<std::filesystem::path> const& Includes, std::filesystem::path const& Pch, std::filesystem::path const& DepFile) {
+    std::vector<std::string> Args = GetClangCommonArgs(Includes);
+    Args.insert(Args.end(), { "-Xclang", "-ast-dump", "-fsyntax-only" });
 
-    std::unique_ptr<FILE, decltype(&PCLOSE)> Pipe(POPEN(ClangASTCommand.c_str(), "r"), PCLOSE);
-    if (!Pipe) {
-        throw std::runtime_error("popen() failed!");
+    if (!Pch.empty()) {
+        Args.push_back("-include-pch");
+        Args.push_back(Pch.string());
     }
 
-    constexpr size_t LineSize = 1024 * 16;
-    char* LineData = new char[LineSize];
-    memset(LineData, 0, LineSize);
-    while (fgets(LineData, LineSize, Pipe.get())) {
-        size_t Len = strlen(LineData);
+    Args.push_back("-MD");
+    Args.push_back("-MF");
+    Args.push_back(DepFile.string());
 
-        LineData[Len - 1] = 0;
-        Func(LineData, Len - 1);
-    }
-    delete[] LineData;
+    Args.push_back(ParsePath.string());
+    return Args;
 }
+
+bool BuildPch(std::filesystem::path const& Header, std::vector<std::filesystem::path> const& Includes, std::filesystem::path const& PchPath, std::filesystem::path const& DepFile, bool Silent) {
+    std::vector<std::string> Args = GetClangCommonArgs(Includes);
+    Args.insert(Args.end(), { "-x", "c++-header", Header.string(), "-o", PchPath.string(), "-MD", "-MF", DepFile.string() });
+
+    if (!Silent) Log(Header, "Clang command: " + CommandToString(Args));
+
+    ChildProcess Clang(Args);
+    Clang.ForEachLine([](std::string_view) { });
+    return Clang.Wait() == 0 && std::filesystem::exists(PchPath);
+}
\ No newline at end of file
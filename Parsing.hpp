@@ -2,8 +2,13 @@
 
 #include "Utilities.hpp"
 
-#include <regex>
+#include <functional>
+#include <memory>
 #include <vector>
+#include <set>
+#include <map>
+#include <string_view>
+#include <optional>
 #include <filesystem>
 
 enum class TagType {
@@ -21,30 +26,127 @@ enum class TagType {
     TranslationUnitDecl
 };
 
-struct ASTNode;
-using ASTPtr = std::shared_ptr<ASTNode>;
-
+// Nodes link to each other by index into the tree that owns them
 struct ASTNode {
+    static constexpr uint32_t None = UINT32_MAX;
+
     int Indent = -1;
     TagType Tag = TagType::INVALID;
-    std::string Line;
+    std::string_view Line;
+
+    uint32_t Parent = None;
+    uint32_t FirstChild = None;
+    uint32_t LastChild = None;
+    uint32_t NextSibling = None;
+};
+
+// Flat node table for one TU, lines live in pooled chunks owned by the tree
+// Destroying the tree releases everything at once
+class ASTTree {
+private:
+    static constexpr size_t ChunkSize = 64 * 1024;
+
+    std::vector<ASTNode> Nodes;
+    std::vector<std::unique_ptr<char[]>> Chunks;
+    char* Chunk = nullptr;
+    size_t ChunkUsed = ChunkSize;
+
+    std::string_view StoreLine(std::string_view Line);
+public:
+    class ChildIterator {
+    private:
+        ASTTree const* Tree;
+        uint32_t Index;
+    public:
+        ChildIterator(ASTTree const* Tree, uint32_t Index) : Tree(Tree), Index(Index) { }
+        ASTNode const& operator*() const { return Tree->Nodes[Index]; }
+        ChildIterator& operator++() { Index = Tree->Nodes[Index].NextSibling; return *this; }
+        bool operator!=(ChildIterator const& Other) const { return Index != Other.Index; }
+    };
+
+    struct ChildRange {
+        ChildIterator Begin;
+        ChildIterator begin() const { return Begin; }
+        ChildIterator end() const { return ChildIterator(nullptr, ASTNode::None); }
+    };
+
+    // Index 0 is a sentinel parent for the top level nodes
+    ASTTree();
+
+    // Copies Line into the tree, returns the new node's index
+    uint32_t AddNode(uint32_t Parent, TagType Tag, int Indent, std::string_view Line);
+
+    ASTNode const& operator[](uint32_t Index) const { return Nodes[Index]; }
+    ASTNode const& GetNode(uint32_t Index) const { return Nodes[Index]; }
 
-    std::shared_ptr<ASTNode> Parent;
-    std::vector<std::shared_ptr<ASTNode>> Children;
+    // The first top level node, the TranslationUnitDecl for a complete dump
+    bool Empty() const { return Nodes[0].FirstChild == ASTNode::None; }
+    ASTNode const& GetRoot() const { return Nodes[Nodes[0].FirstChild]; }
+
+    ChildRange Children(ASTNode const& Node) const { return ChildRange { ChildIterator(this, Node.FirstChild) }; }
+    size_t Size() const { return Nodes.size() - 1; }
 };
 
-std::vector<std::string> SplitForTemplate(std::string const& Val);
+// Scanners for the text after the tag of a dump line, results point into Line and nothing is allocated
+// Each one matches exactly what the regex or split it replaced did
+
+// "class Name definition", same as searching for "class ([a-zA-Z0-9_]+) definition"
+std::optional<std::string_view> ScanClassDefinition(std::string_view Line);
+
+// "Name 'Type'", same as searching for "([a-zA-Z0-9_]+) '([a-zA-Z0-9_:<>, \*\&\[\]]+)'"
+bool ScanField(std::string_view Line, std::string_view& Name, std::string_view& Type);
 
-bool GetTemplateParams(std::string const& Line, std::string& Type, std::string& Name, bool& HasType);
+// "class Name 'Underlying'", only scoped enums with an explicit type are matched
+bool ScanEnum(std::string_view Line, std::string_view& Name, std::string_view& Underlying);
 
-std::vector<std::string> GetAllHeaders(std::filesystem::path const& Path, std::vector<std::filesystem::path> const& Includes, bool Silent);
+// "... typename depth 0 index 0 Name", Name is empty for unnamed parameters
+bool GetTemplateParams(std::string_view Line, std::string_view& Type, std::string_view& Name);
 
-void DeleteNode(ASTPtr Node);
+// Reads the headers listed in a Makefile style dependency file written by clang -MD
+std::vector<std::string> GetAllHeaders(std::filesystem::path const& DepFilePath);
+
+// Answers whether a path, spelled however clang printed it, is one of the user's input files
+// Only declarations from these files are materialized, everything from system and third-party headers is skipped
+class ProjectFileFilter {
+private:
+    std::set<std::string> const& ProjectFiles;
+    std::map<std::string, bool, std::less<>> Spellings;
+    bool CurrentInProject = true;
+public:
+    // ProjectFiles must hold canonical paths
+    ProjectFileFilter(std::set<std::string> const& ProjectFiles);
+
+    bool Contains(std::string_view Path);
+
+    // Clang only prints a file name when it differs from the previously printed location, "line:" and "col:" stay in that file
+    // Follows those locations and returns whether the first one on the line is in a project file
+    bool TrackDumpLine(std::string_view Line);
+};
 
 bool StartsWith(uint32_t& OutSize, char const* Line, size_t LineSize, char const* Match, uint32_t const& MatchSize);
 
 TagType BeginsWithValidTag(char const* Line, size_t LineSize, uint32_t& End);
 
-ASTPtr LoadASTNodes(std::filesystem::path const& ASTFile, std::vector<std::filesystem::path> const& Includes, bool Silent);
+// Top level declarations outside ProjectFiles are skipped with their whole subtree, except namespaces and enums
+// Enums are kept so fields of enum types declared in other headers still serialize through their underlying type
+// Pch is passed to clang with -include-pch unless it is empty
+ASTTree LoadASTNodes(std::filesystem::path const& ASTFile, std::vector<std::filesystem::path> const& Includes, std::filesystem::path const& Pch, std::filesystem::path const& DepFile, std::set<std::string> const& ProjectFiles, bool Silent);
+
+// Language options and include paths, a precompiled header is only usable with the exact options it was built with
+std::vector<std::string> GetClangCommonArgs(std::vector<std::filesystem::path> const& Includes);
+
+// Command line of a clang run that dumps the AST of ParsePath and writes its dependencies to DepFile
+std::vector<std::string> GetClangASTArgs(std::filesystem::path const& ParsePath, std::vector<std::filesystem::path> const& Includes, std::filesystem::path const& Pch, std::filesystem::path const& DepFile);
+
+// Precompiles Header to PchPath, writing its dependencies to DepFile, returns false if clang failed
+bool BuildPch(std::filesystem::path const& Header, std::vector<std::filesystem::path> const& Includes, std::filesystem::path const& PchPath, std::filesystem::path const& DepFile, bool Silent);
+
+// Runs clang once, streaming every line of the AST dump to Func as a string_view
+template<typename F>
+void ClangASTLinesPiped(std::filesystem::path const& ParsePath, std::vector<std::filesystem::path> const& Includes, std::filesystem::path const& Pch, std::filesystem::path const& DepFile, F&& Func, bool Silent) {
+    std::vector<std::string> const Args = GetClangASTArgs(ParsePath, Includes, Pch, DepFile);
+    if (!Silent) Log(ParsePath, "Clang command: " + CommandToString(Args));
 
-void ClangASTLinesPiped(std::filesystem::path const& ParsePath, std::vector<std::filesystem::path> const& Includes, std::function<void(const char*, size_t)> const& Func, bool Silent);
+    ChildProcess Clang(Args);
+    Clang.ForEachLine(Func);
+}
@@ -1,7 +1,12 @@
 // Generating, please wait...
 
+#ifndef AUTOREFLECT_NULL_GENERATED
+#define AUTOREFLECT_NULL_GENERATED
+
+#ifndef AUTOREFLECT_DECLS
 class Serializer { };
 class Deserializer { };
+#endif
 
 template <typename T>
 inline void Serialize(Serializer&, char const*, T const&) { }
@@ -9,4 +14,6 @@ inline void Serialize(Serializer&, char const*, T const&) { }
 template <typename T>
 inline void Deserialize(Deserializer&, char const*, T&) { }
 
+#endif // AUTOREFLECT_NULL_GENERATED
+
 // Generating, please wait...
\ No newline at end of file
@@ -0,0 +1,130 @@
+#include "Trace.hpp"
+
+#include <fstream>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    std::atomic_bool TraceEnabled = false;
+    std::filesystem::path TracePath;
+    std::chrono::steady_clock::time_point TraceStart;
+
+    std::mutex TraceMutex;
+    nlohmann::json TraceEvents = nlohmann::json::array();
+    std::map<std::string, int64_t> TraceCounters;
+
+    std::atomic_int NextThreadId = 1;
+
+    int64_t GetProcessId() {
+#ifndef _WIN32
+        return static_cast<int64_t>(getpid());
+#else
+        return 1;
+#endif
+    }
+
+    // Small stable ids read better in the viewer than native thread ids
+    int GetThreadId() {
+        thread_local int Id = NextThreadId++;
+        return Id;
+    }
+
+    int64_t MicrosecondsSinceStart(std::chrono::steady_clock::time_point Time) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(Time - TraceStart).count();
+    }
+
+    // Peak resident set in KiB of this process or of its largest child, 0 where it can't be queried
+    int64_t GetPeakRSS(bool Children) {
+#ifndef _WIN32
+        struct rusage Usage;
+        if (getrusage(Children ? RUSAGE_CHILDREN : RUSAGE_SELF, &Usage) != 0) return 0;
+#ifdef __APPLE__
+        return static_cast<int64_t>(Usage.ru_maxrss) / 1024;
+#else
+        return static_cast<int64_t>(Usage.ru_maxrss);
+#endif
+#else
+        (void)Children;
+        return 0;
+#endif
+    }
+}
+
+void TraceRecorder::Start(std::filesystem::path const& Path) {
+    std::lock_guard<std::mutex> Lock(TraceMutex);
+    TracePath = Path;
+    TraceStart = std::chrono::steady_clock::now();
+    TraceEnabled = true;
+}
+
+bool TraceRecorder::Enabled() {
+    return TraceEnabled.load(std::memory_order_relaxed);
+}
+
+void TraceRecorder::AddCounter(char const* Name, int64_t Value) {
+    if (!Enabled()) return;
+
+    auto const Now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> Lock(TraceMutex);
+    int64_t& Total = TraceCounters[Name];
+    Total += Value;
+    TraceEvents.push_back({
+        { "name", Name }, { "ph", "C" }, { "ts", MicrosecondsSinceStart(Now) },
+        { "pid", GetProcessId() }, { "tid", GetThreadId() }, { "args", { { Name, Total } } }
+    });
+}
+
+void TraceRecorder::Complete(char const* Name, std::string const& File, std::chrono::steady_clock::time_point Start, std::vector<std::pair<char const*, int64_t>> const& Args) {
+    auto const End = std::chrono::steady_clock::now();
+
+    nlohmann::json Event = {
+        { "name", Name }, { "cat", "AutoReflect" }, { "ph", "X" },
+        { "ts", MicrosecondsSinceStart(Start) }, { "dur", std::chrono::duration_cast<std::chrono::microseconds>(End - Start).count() },
+        { "pid", GetProcessId() }, { "tid", GetThreadId() }
+    };
+    nlohmann::json& EventArgs = Event["args"] = nlohmann::json::object();
+    if (!File.empty()) EventArgs["File"] = File;
+    for (auto const& [ArgName, Value] : Args) EventArgs[ArgName] = Value;
+
+    std::lock_guard<std::mutex> Lock(TraceMutex);
+    TraceEvents.push_back(std::move(Event));
+}
+
+void TraceRecorder::Save() {
+    if (!Enabled()) return;
+
+    std::lock_guard<std::mutex> Lock(TraceMutex);
+
+    nlohmann::json Trace;
+    Trace["traceEvents"] = TraceEvents;
+    Trace["displayTimeUnit"] = "ms";
+
+    nlohmann::json& Other = Trace["otherData"];
+    Other["PeakRSSKiB"] = GetPeakRSS(false);
+    Other["PeakClangRSSKiB"] = GetPeakRSS(true);
+    for (auto const& [Name, Total] : TraceCounters) Other[Name] = Total;
+
+    if (TracePath.has_parent_path()) std::filesystem::create_directories(TracePath.parent_path());
+    std::ofstream File(TracePath);
+    File << Trace.dump();
+}
+
+TraceScope::TraceScope(char const* Name, std::filesystem::path const& File)
+    : Name(Name)
+    , Active(TraceRecorder::Enabled())
+{
+    if (!Active) return;
+    this->File = File.string();
+    Start = std::chrono::steady_clock::now();
+}
+
+TraceScope::~TraceScope() {
+    if (Active) TraceRecorder::Complete(Name, File, Start, Args);
+}
+
+void TraceScope::AddArg(char const* ArgName, int64_t Value) {
+    if (Active) Args.emplace_back(ArgName, Value);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "Utilities.hpp"
+
+#include <chrono>
+
+// Chrome trace event recording for --trace, the output opens in chrome://tracing or ui.perfetto.dev
+// While tracing is off every call costs one branch
+class TraceRecorder {
+public:
+    static void Start(std::filesystem::path const& Path);
+    static bool Enabled();
+
+    // Adds Value to a running total, shown as a counter track and listed in the trace metadata
+    static void AddCounter(char const* Name, int64_t Value);
+
+    // Writes everything recorded so far, along with the peak RSS of this process and of its clang children
+    static void Save();
+
+    static void Complete(char const* Name, std::string const& File, std::chrono::steady_clock::time_point Start, std::vector<std::pair<char const*, int64_t>> const& Args);
+};
+
+// Records one complete event on the calling thread for its lifetime
+class TraceScope {
+private:
+    char const* Name;
+    std::string File;
+    std::chrono::steady_clock::time_point Start;
+    std::vector<std::pair<char const*, int64_t>> Args;
+    bool Active;
+public:
+    TraceScope(char const* Name, std::filesystem::path const& File = std::filesystem::path());
+    ~TraceScope();
+    TraceScope(TraceScope const&) = delete;
+    TraceScope& operator=(TraceScope const&) = delete;
+
+    void AddArg(char const* ArgName, int64_t Value);
+};
+
+// Locks Mutex, adding the time spent waiting for it to the LockWaitUs counter
+template<typename MutexType>
+std::unique_lock<MutexType> LockTraced(MutexType& Mutex) {
+    if (!TraceRecorder::Enabled()) return std::unique_lock<MutexType>(Mutex);
+
+    auto const Start = std::chrono::steady_clock::now();
+    std::unique_lock<MutexType> Lock(Mutex);
+    TraceRecorder::AddCounter("LockWaitUs", std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - Start).count());
+    return Lock;
+}
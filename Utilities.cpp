@@ -2,6 +2,17 @@
 
 #include <iostream>
 #include <fstream>
+#include <cstring>
+
+#ifndef _WIN32
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+
+extern char** environ;
+#endif
 
 void Log(std::filesystem::path const& Task, std::string const& Str) {
     static std::mutex Mutex;
@@ -10,5 +21,399 @@ void Log(std::filesystem::path const& Task, std::string const& Str) {
     std::cout << Task << ": " << Str << std::endl;
 }
 
+std::string PathToString(std::filesystem::path const& Path) {
+    std::string Str = Path.string();
+    for (auto& C : Str) {
+        if (C == '/') C = '_';
+    }
+    return Str;
+}
+
+namespace {
+    constexpr uint64_t XXHPrime1 = 11400714785074694791ULL;
+    constexpr uint64_t XXHPrime2 = 14029467366897019727ULL;
+    constexpr uint64_t XXHPrime3 = 1609587929392839161ULL;
+    constexpr uint64_t XXHPrime4 = 9650029242287828579ULL;
+    constexpr uint64_t XXHPrime5 = 2870177450012600261ULL;
+
+    inline uint64_t RotL64(uint64_t X, int R) { return (X << R) | (X >> (64 - R)); }
+
+    inline uint64_t Read64(uint8_t const* P) { uint64_t V; memcpy(&V, P, sizeof(V)); return V; }
+    inline uint32_t Read32(uint8_t const* P) { uint32_t V; memcpy(&V, P, sizeof(V)); return V; }
+
+    inline uint64_t XXHRound(uint64_t Acc, uint64_t Input) {
+        Acc += Input * XXHPrime2;
+        Acc = RotL64(Acc, 31);
+        return Acc * XXHPrime1;
+    }
+
+    inline uint64_t XXHMergeRound(uint64_t Acc, uint64_t Val) {
+        Acc ^= XXHRound(0, Val);
+        return Acc * XXHPrime1 + XXHPrime4;
+    }
+}
+
+uint64_t HashBytes(void const* Data, size_t Size, uint64_t Seed) {
+    uint8_t const* P = static_cast<uint8_t const*>(Data);
+    uint8_t const* const End = P + Size;
+    uint64_t H;
+
+    if (Size >= 32) {
+        uint64_t V1 = Seed + XXHPrime1 + XXHPrime2;
+        uint64_t V2 = Seed + XXHPrime2;
+        uint64_t V3 = Seed;
+        uint64_t V4 = Seed - XXHPrime1;
+
+        uint8_t const* const Limit = End - 32;
+        do {
+            V1 = XXHRound(V1, Read64(P)); P += 8;
+            V2 = XXHRound(V2, Read64(P)); P += 8;
+            V3 = XXHRound(V3, Read64(P)); P += 8;
+            V4 = XXHRound(V4, Read64(P)); P += 8;
+        } while (P <= Limit);
+
+        H = RotL64(V1, 1) + RotL64(V2, 7) + RotL64(V3, 12) + RotL64(V4, 18);
+        H = XXHMergeRound(H, V1);
+        H = XXHMergeRound(H, V2);
+        H = XXHMergeRound(H, V3);
+        H = XXHMergeRound(H, V4);
+    } else {
+        H = Seed + XXHPrime5;
+    }
+
+    H += static_cast<uint64_t>(Size);
+
+    while (P + 8 <= End) {
+        H ^= XXHRound(0, Read64(P));
+        H = RotL64(H, 27) * XXHPrime1 + XXHPrime4;
+        P += 8;
+    }
+
+    if (P + 4 <= End) {
+        H ^= static_cast<uint64_t>(Read32(P)) * XXHPrime1;
+        H = RotL64(H, 23) * XXHPrime2 + XXHPrime3;
+        P += 4;
+    }
+
+    while (P < End) {
+        H ^= static_cast<uint64_t>(*P) * XXHPrime5;
+        H = RotL64(H, 11) * XXHPrime1;
+        ++P;
+    }
+
+    H ^= H >> 33;
+    H *= XXHPrime2;
+    H ^= H >> 29;
+    H *= XXHPrime3;
+    H ^= H >> 32;
+
+    return H;
+}
+
+std::optional<uint64_t> HashFile(std::filesystem::path const& Path) {
+    std::ifstream File(Path, std::ios::binary);
+    if (!File) return std::nullopt;
+
+    std::string Contents((std::istreambuf_iterator<char>(File)), std::istreambuf_iterator<char>());
+    return HashBytes(Contents.data(), Contents.size());
+}
+
+bool WriteIfChanged(std::filesystem::path const& Path, std::string_view Contents) {
+    std::error_code Ec;
+    auto const ExistingSize = std::filesystem::file_size(Path, Ec);
+
+    if (!Ec && ExistingSize == Contents.size()) {
+        std::ifstream Existing(Path, std::ios::binary);
+        std::string ExistingContents((std::istreambuf_iterator<char>(Existing)), std::istreambuf_iterator<char>());
+        if (ExistingContents == Contents) return false;
+    }
+
+    std::ofstream File(Path, std::ios::binary | std::ios::trunc);
+    File.write(Contents.data(), static_cast<std::streamsize>(Contents.size()));
+    return true;
+}
+
+std::string EscapeDepfilePath(std::string_view Path) {
+    std::string Escaped;
+    for (char C : Path) {
+        if (C == ' ' || C == '#') Escaped += '\\';
+        if (C == '$') Escaped += '$';
+        Escaped += C;
+    }
+    return Escaped;
+}
+
+void WriteDepfile(std::filesystem::path const& DepfilePath, std::filesystem::path const& Target, std::vector<std::string> const& Dependencies) {
+    std::string Contents = EscapeDepfilePath(std::filesystem::absolute(Target).lexically_normal().generic_string()) + ":";
+    for (auto const& Dep : Dependencies) {
+        Contents += " \\\n  " + EscapeDepfilePath(std::filesystem::absolute(Dep).lexically_normal().generic_string());
+    }
+    Contents += "\n";
+
+    WriteIfChanged(DepfilePath, Contents);
+}
+
 CallOnDtor::CallOnDtor(std::function<void()> Func) : Func(Func) { }
-CallOnDtor::~CallOnDtor() { Func(); }
\ No newline at end of file
+CallOnDtor::~CallOnDtor() { Func(); }
+
+namespace {
+    std::mutex BudgetMutex;
+    std::condition_variable BudgetReleased;
+    size_t BudgetLimit = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    size_t BudgetInUse = 0;
+}
+
+void ProcessBudget::SetLimit(size_t Limit) {
+    std::lock_guard<std::mutex> Lock(BudgetMutex);
+    BudgetLimit = std::max<size_t>(Limit, 1);
+    BudgetReleased.notify_all();
+}
+
+void ProcessBudget::Acquire() {
+    std::unique_lock<std::mutex> Lock(BudgetMutex);
+    BudgetReleased.wait(Lock, []() { return BudgetInUse < BudgetLimit; });
+    ++BudgetInUse;
+}
+
+void ProcessBudget::Release() {
+    std::lock_guard<std::mutex> Lock(BudgetMutex);
+    --BudgetInUse;
+    BudgetReleased.notify_one();
+}
+
+ProcessSlot::ProcessSlot() { ProcessBudget::Acquire(); }
+ProcessSlot::~ProcessSlot() { ProcessBudget::Release(); }
+
+std::string CommandToString(std::vector<std::string> const& Args) {
+    std::string Command;
+    for (auto const& Arg : Args) {
+        if (!Command.empty()) Command += ' ';
+        if (Arg.find(' ') != std::string::npos) Command += '"' + Arg + '"';
+        else Command += Arg;
+    }
+    return Command;
+}
+
+#ifndef _WIN32
+ChildProcess::ChildProcess(std::vector<std::string> const& Args) {
+    // Other workers spawn concurrently, their children must not inherit either end of this pipe
+    int Fds[2];
+#ifdef __linux__
+    if (pipe2(Fds, O_CLOEXEC) != 0) throw std::runtime_error("pipe() failed");
+#else
+    if (pipe(Fds) != 0) throw std::runtime_error("pipe() failed");
+    fcntl(Fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(Fds[1], F_SETFD, FD_CLOEXEC);
+#endif
+
+    posix_spawn_file_actions_t Actions;
+    posix_spawn_file_actions_init(&Actions);
+    posix_spawn_file_actions_adddup2(&Actions, Fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addopen(&Actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+    std::vector<char*> Argv;
+    for (auto const& Arg : Args) Argv.push_back(const_cast<char*>(Arg.c_str()));
+    Argv.push_back(nullptr);
+
+    int const Error = posix_spawnp(&Pid, Argv[0], &Actions, nullptr, Argv.data(), environ);
+    posix_spawn_file_actions_destroy(&Actions);
+    close(Fds[1]);
+
+    if (Error != 0) {
+        close(Fds[0]);
+        Pid = -1;
+        throw std::runtime_error("Could not start " + Args[0] + ": " + strerror(Error));
+    }
+
+    Fd = Fds[0];
+}
+
+ChildProcess::~ChildProcess() {
+    Wait();
+}
+
+ptrdiff_t ChildProcess::Read(char* Dest, size_t Size) {
+    ssize_t Count;
+    do {
+        Count = read(Fd, Dest, Size);
+    } while (Count < 0 && errno == EINTR);
+    return Count;
+}
+
+int ChildProcess::Wait() {
+    if (Fd >= 0) {
+        close(Fd);
+        Fd = -1;
+    }
+    if (Pid < 0) return -1;
+
+    int Status = 0;
+    while (waitpid(Pid, &Status, 0) < 0 && errno == EINTR) { }
+    Pid = -1;
+    return WIFEXITED(Status) ? WEXITSTATUS(Status) : -1;
+}
+#else
+ChildProcess::ChildProcess(std::vector<std::string> const& Args) {
+    std::string const Command = "cmd /c \"" + CommandToString(Args) + " 2>NUL\"";
+    Pipe = _popen(Command.c_str(), "r");
+    if (!Pipe) throw std::runtime_error("Could not start " + Args[0]);
+}
+
+ChildProcess::~ChildProcess() {
+    Wait();
+}
+
+ptrdiff_t ChildProcess::Read(char* Dest, size_t Size) {
+    return static_cast<ptrdiff_t>(fread(Dest, 1, Size, Pipe));
+}
+
+int ChildProcess::Wait() {
+    if (!Pipe) return -1;
+    int const Status = _pclose(Pipe);
+    Pipe = nullptr;
+    return Status;
+}
+#endif
+
+void FileTimings::Load(std::filesystem::path const& Path) {
+    std::ifstream File(Path);
+    if (!File) return;
+
+    try {
+        nlohmann::json J = nlohmann::json::parse(File);
+        std::lock_guard<std::mutex> Lock(Mutex);
+        Seconds = J.get<std::map<std::string, double>>();
+    } catch (nlohmann::json::exception const&) {
+        // A corrupt timings file only affects scheduling order
+    }
+}
+
+void FileTimings::Save(std::filesystem::path const& Path) const {
+    std::filesystem::create_directories(Path.parent_path());
+
+    std::lock_guard<std::mutex> Lock(Mutex);
+    std::ofstream File(Path);
+    File << nlohmann::json(Seconds).dump();
+}
+
+void FileTimings::Record(std::filesystem::path const& File, double Elapsed) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Seconds[File.string()] = Elapsed;
+}
+
+double FileTimings::EstimateCost(std::filesystem::path const& File) const {
+    std::error_code Ec;
+    auto const Size = std::filesystem::file_size(File, Ec);
+    double const Bytes = Ec ? 0.0 : static_cast<double>(Size);
+
+    std::lock_guard<std::mutex> Lock(Mutex);
+    auto const Found = Seconds.find(File.string());
+    if (Found != Seconds.end()) return Found->second;
+
+    // Use the average cost per byte of known files so estimates are comparable to real timings
+    double KnownSeconds = 0.0, KnownBytes = 0.0;
+    for (auto const& kvp : Seconds) {
+        auto const KnownSize = std::filesystem::file_size(kvp.first, Ec);
+        if (Ec) continue;
+        KnownSeconds += kvp.second;
+        KnownBytes += static_cast<double>(KnownSize);
+    }
+
+    return (KnownBytes > 0.0) ? Bytes * (KnownSeconds / KnownBytes) : Bytes;
+}
+
+WorkerPool::WorkerPool(size_t NumWorkers) {
+    NumWorkers = std::max<size_t>(NumWorkers, 1);
+    for (size_t i = 0; i < NumWorkers; ++i) Queues.push_back(std::make_unique<WorkQueue>());
+    for (size_t i = 0; i < NumWorkers; ++i) Threads.emplace_back([this, i]() { WorkerLoop(i); });
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> Lock(StateMutex);
+        Stopping = true;
+    }
+    WakeWorkers.notify_all();
+    for (auto& Thread : Threads) Thread.join();
+}
+
+bool WorkerPool::PopOrSteal(size_t WorkerIndex, size_t& Out) {
+    {
+        WorkQueue& Own = *Queues[WorkerIndex];
+        std::lock_guard<std::mutex> Lock(Own.Mutex);
+        if (!Own.Items.empty()) {
+            Out = Own.Items.front();
+            Own.Items.pop_front();
+            return true;
+        }
+    }
+
+    for (size_t Offset = 1; Offset < Queues.size(); ++Offset) {
+        WorkQueue& Victim = *Queues[(WorkerIndex + Offset) % Queues.size()];
+        std::lock_guard<std::mutex> Lock(Victim.Mutex);
+        if (!Victim.Items.empty()) {
+            Out = Victim.Items.back();
+            Victim.Items.pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void WorkerPool::WorkerLoop(size_t WorkerIndex) {
+    size_t SeenGeneration = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> Lock(StateMutex);
+            WakeWorkers.wait(Lock, [&]() { return Stopping || Generation != SeenGeneration; });
+            if (Stopping) return;
+            SeenGeneration = Generation;
+        }
+
+        size_t Index;
+        while (PopOrSteal(WorkerIndex, Index)) {
+            try {
+                CurrentTask(Index);
+            } catch (...) {
+                std::lock_guard<std::mutex> Lock(StateMutex);
+                if (!FirstError) FirstError = std::current_exception();
+            }
+
+            if (Remaining.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> Lock(StateMutex);
+                BatchDone.notify_all();
+            }
+        }
+    }
+}
+
+void WorkerPool::RunBatch(std::vector<size_t> const& Order, std::function<void(size_t)> Task) {
+    if (Order.empty()) return;
+
+    std::lock_guard<std::mutex> BatchLock(BatchMutex);
+
+    {
+        std::lock_guard<std::mutex> Lock(StateMutex);
+        CurrentTask = std::move(Task);
+        FirstError = nullptr;
+        Remaining = Order.size();
+    }
+
+    // Deal the work round robin, so every worker starts on one of the most expensive items
+    for (size_t i = 0; i < Order.size(); ++i) {
+        WorkQueue& Queue = *Queues[i % Queues.size()];
+        std::lock_guard<std::mutex> Lock(Queue.Mutex);
+        Queue.Items.push_back(Order[i]);
+    }
+
+    std::unique_lock<std::mutex> Lock(StateMutex);
+    ++Generation;
+    WakeWorkers.notify_all();
+
+    BatchDone.wait(Lock, [this]() { return Remaining.load() == 0; });
+    CurrentTask = nullptr;
+
+    if (FirstError) std::rethrow_exception(FirstError);
+}
@@ -1,29 +1,74 @@
 #pragma once
 
 #include <functional>
+#include <algorithm>
+#include <memory>
 #include <vector>
+#include <deque>
+#include <map>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include <filesystem>
 #include <optional>
 #include <set>
+#include <string>
+#include <string_view>
 #include <nlohmann/json.hpp>
 
-#ifndef _WIN32 
-#define POPEN popen
-#define PCLOSE pclose
-#else
-#define POPEN _popen
-#define PCLOSE _pclose
+#include <cstring>
+#include <cstdio>
+
+#ifndef _WIN32
+#include <sys/types.h>
 #endif
 
+#define CacheDirectory ".AutoReflect"
+
 enum class GenMode : int {
     ForwardDeclMode,
     RegularMode,
-    InlineMode
+    InlineMode,
+    InlineForwardDeclMode
 };
 
 void Log(std::filesystem::path const& Task, std::string const& Str);
 
+// Flattens a path into a single file name usable inside the cache directory
+std::string PathToString(std::filesystem::path const& Path);
+
+// 64 bit xxHash (XXH64) of a byte range
+uint64_t HashBytes(void const* Data, size_t Size, uint64_t Seed = 0);
+std::optional<uint64_t> HashFile(std::filesystem::path const& Path);
+
+// Only touches the file if its contents would change, returns true if it was written
+bool WriteIfChanged(std::filesystem::path const& Path, std::string_view Contents);
+
+// Escapes a path for a Makefile style dependency file, as read by make and ninja
+std::string EscapeDepfilePath(std::string_view Path);
+
+// Writes "Target: Dependencies..." with absolute paths, so the file means the same from any working directory
+// Only touches the file if its contents would change
+void WriteDepfile(std::filesystem::path const& DepfilePath, std::filesystem::path const& Target, std::vector<std::string> const& Dependencies);
+
+// Generated source is appended straight into one buffer and handed to WriteIfChanged as a whole
+// Clear keeps the capacity, so a writer reused for every file stops allocating after the largest one
+class CodeWriter {
+private:
+    std::string Buffer;
+public:
+    CodeWriter& operator<<(std::string_view Str) { Buffer.append(Str.data(), Str.size()); return *this; }
+    CodeWriter& operator<<(char const* Str) { Buffer.append(Str); return *this; }
+    CodeWriter& operator<<(std::string const& Str) { Buffer.append(Str); return *this; }
+    CodeWriter& operator<<(char C) { Buffer.push_back(C); return *this; }
+
+    std::string_view View() const { return Buffer; }
+    void Clear() { Buffer.clear(); }
+
+    bool WriteIfChanged(std::filesystem::path const& Path) const { return ::WriteIfChanged(Path, Buffer); }
+};
+
 struct CallOnDtor {
     std::function<void()> Func;
     CallOnDtor(std::function<void()> Func);
@@ -34,39 +79,173 @@ struct CallOnDtor {
     CallOnDtor& operator=(CallOnDtor&&) = delete;
 };
 
-template<typename F, typename T>
-inline void ParallelFor(F Func, std::vector<T> const& Inputs) {
-    std::vector<std::thread> Threads;
-    Threads.resize(std::thread::hardware_concurrency());
-    std::vector<std::atomic<int>*> ThreadStates; // 0 = fresh, 1 = done, 2 = running
-    for (size_t i = 0; i < Threads.size(); ++i) ThreadStates.push_back(new std::atomic<int>(0));
-
-    for (size_t i = 0; i < Inputs.size();) {
-        bool Found = false;
-        for (size_t ThreadIndex = 0; ThreadIndex < Threads.size(); ++ThreadIndex) {
-            if (ThreadStates[ThreadIndex]->load() <= 1) {
-                if (ThreadStates[ThreadIndex]->load() == 1) Threads[ThreadIndex].join();
-                ThreadStates[ThreadIndex]->store(2);
-                Threads[ThreadIndex] = std::thread([Func, &ThreadStates, ThreadIndex, &Inputs, i](){
-                    CallOnDtor OnDtor([&ThreadStates, ThreadIndex](){
-                        ThreadStates[ThreadIndex]->store(1);
-                    });
-
-                    Func(Inputs[i]);
-                });
-                Found = true;
-                ++i;
-                break;
+// Limits how many child processes (clang) may run at once, shared by every worker
+class ProcessBudget {
+public:
+    static void SetLimit(size_t Limit);
+    static void Acquire();
+    static void Release();
+};
+
+// Holds one slot of the ProcessBudget for its lifetime
+struct ProcessSlot {
+    ProcessSlot();
+    ~ProcessSlot();
+    ProcessSlot(ProcessSlot const&) = delete;
+    ProcessSlot(ProcessSlot&&) = delete;
+    ProcessSlot& operator=(ProcessSlot const&) = delete;
+    ProcessSlot& operator=(ProcessSlot&&) = delete;
+};
+
+// Calls Visit with every line Read produces, without the line break
+// Read(char* Dest, size_t Size) returns the number of bytes it read, 0 at the end
+// Lines are views into one large buffer, which grows to fit the longest line, so there is no length limit
+// memchr is vectorized in every libc we care about, so finding line breaks is rarely the bottleneck
+template<typename ReadFunc, typename VisitFunc>
+void ForEachLine(ReadFunc&& Read, VisitFunc&& Visit) {
+    std::vector<char> Buffer(1024 * 1024);
+    size_t Begin = 0, End = 0;
+
+    while (true) {
+        if (End == Buffer.size()) {
+            if (Begin > 0) {
+                memmove(Buffer.data(), Buffer.data() + Begin, End - Begin);
+                End -= Begin;
+                Begin = 0;
+            } else {
+                Buffer.resize(Buffer.size() * 2);
             }
         }
-        if (!Found) std::this_thread::sleep_for(std::chrono::milliseconds(1));
-    }
 
-    // Join any remaining threads
-    for (size_t ThreadIndex = 0; ThreadIndex < Threads.size(); ++ThreadIndex) {
-        if (ThreadStates[ThreadIndex]->load() != 0) {
-            Threads[ThreadIndex].join();
+        size_t Scan = End;
+        auto const Count = Read(Buffer.data() + End, Buffer.size() - End);
+        if (Count <= 0) break;
+        End += static_cast<size_t>(Count);
+
+        while (char const* LineBreak = static_cast<char const*>(memchr(Buffer.data() + Scan, '\n', End - Scan))) {
+            size_t const LineEnd = LineBreak - Buffer.data();
+            Visit(std::string_view(Buffer.data() + Begin, LineEnd - Begin));
+            Begin = Scan = LineEnd + 1;
         }
-        delete ThreadStates[ThreadIndex];
+
+        if (Begin == End) Begin = End = 0;
+    }
+
+    if (Begin < End) Visit(std::string_view(Buffer.data() + Begin, End - Begin));
+}
+
+// Same as above, reading the lines of a file, returns false if it couldn't be opened
+template<typename VisitFunc>
+bool ForEachLineInFile(std::filesystem::path const& Path, VisitFunc&& Visit) {
+    std::unique_ptr<FILE, decltype(&fclose)> File(fopen(Path.string().c_str(), "rb"), fclose);
+    if (!File) return false;
+
+    ForEachLine([&File](char* Dest, size_t Size) { return fread(Dest, 1, Size, File.get()); }, Visit);
+    return true;
+}
+
+// Quotes arguments with spaces, only meant for logging and the Windows shell
+std::string CommandToString(std::vector<std::string> const& Args);
+
+// Runs Args[0], searched for on PATH, with its stdout connected to a pipe and its stderr discarded
+// Holds a ProcessBudget slot until the process has exited
+class ChildProcess {
+private:
+    ProcessSlot Slot;
+#ifndef _WIN32
+    pid_t Pid = -1;
+    int Fd = -1;
+#else
+    FILE* Pipe = nullptr;
+#endif
+public:
+    ChildProcess(std::vector<std::string> const& Args);
+    ~ChildProcess();
+    ChildProcess(ChildProcess const&) = delete;
+    ChildProcess(ChildProcess&&) = delete;
+    ChildProcess& operator=(ChildProcess const&) = delete;
+    ChildProcess& operator=(ChildProcess&&) = delete;
+
+    // Returns the number of bytes read from the child's stdout, 0 once it is closed
+    ptrdiff_t Read(char* Dest, size_t Size);
+
+    // Waits for the child to exit and returns its exit code
+    int Wait();
+
+    template<typename VisitFunc>
+    void ForEachLine(VisitFunc&& Visit) {
+        ::ForEachLine([this](char* Dest, size_t Size) { return Read(Dest, Size); }, Visit);
+    }
+};
+
+// Per file generation times from previous runs, used to schedule expensive files first
+class FileTimings {
+private:
+    std::map<std::string, double> Seconds;
+    mutable std::mutex Mutex;
+public:
+    void Load(std::filesystem::path const& Path);
+    void Save(std::filesystem::path const& Path) const;
+
+    void Record(std::filesystem::path const& File, double Elapsed);
+
+    // Previous timing if known, otherwise an estimate from the file size
+    double EstimateCost(std::filesystem::path const& File) const;
+};
+
+// Persistent pool of worker threads, each with its own deque of work
+// Idle workers steal from the back of other workers' deques
+class WorkerPool {
+private:
+    struct WorkQueue {
+        std::mutex Mutex;
+        std::deque<size_t> Items;
+    };
+
+    std::vector<std::thread> Threads;
+    std::vector<std::unique_ptr<WorkQueue>> Queues;
+
+    std::mutex BatchMutex; // Only one batch runs at a time
+    std::mutex StateMutex;
+    std::condition_variable WakeWorkers;
+    std::condition_variable BatchDone;
+    std::function<void(size_t)> CurrentTask;
+    std::atomic<size_t> Remaining = 0;
+    size_t Generation = 0;
+    bool Stopping = false;
+    std::exception_ptr FirstError;
+
+    void WorkerLoop(size_t WorkerIndex);
+    bool PopOrSteal(size_t WorkerIndex, size_t& Out);
+    void RunBatch(std::vector<size_t> const& Order, std::function<void(size_t)> Task);
+public:
+    explicit WorkerPool(size_t NumWorkers);
+    ~WorkerPool();
+    WorkerPool(WorkerPool const&) = delete;
+    WorkerPool& operator=(WorkerPool const&) = delete;
+
+    size_t GetNumWorkers() const { return Threads.size(); }
+
+    // Runs Func on every input, must not be called from inside a worker
+    template<typename F, typename T>
+    void ParallelFor(F Func, std::vector<T> const& Inputs) {
+        std::vector<size_t> Order(Inputs.size());
+        for (size_t i = 0; i < Order.size(); ++i) Order[i] = i;
+
+        RunBatch(Order, [&Func, &Inputs](size_t i) { Func(Inputs[i]); });
+    }
+
+    // Same as above, but inputs with the highest cost are started first
+    template<typename F, typename T, typename C>
+    void ParallelFor(F Func, std::vector<T> const& Inputs, C Cost) {
+        std::vector<double> Costs;
+        Costs.reserve(Inputs.size());
+        for (auto const& Input : Inputs) Costs.push_back(Cost(Input));
+
+        std::vector<size_t> Order(Inputs.size());
+        for (size_t i = 0; i < Order.size(); ++i) Order[i] = i;
+        std::stable_sort(Order.begin(), Order.end(), [&Costs](size_t A, size_t B) { return Costs[A] > Costs[B]; });
+
+        RunBatch(Order, [&Func, &Inputs](size_t i) { Func(Inputs[i]); });
     }
-}
\ No newline at end of file
+};
\ No newline at end of file
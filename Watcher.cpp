@@ -0,0 +1,212 @@
+#include "Watcher.hpp"
+
+#include <iostream>
+#include <chrono>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+namespace {
+    // Time to wait for more events before regenerating, editors often write a file in several steps
+    constexpr auto DebounceTime = std::chrono::milliseconds(50);
+
+    std::string CanonicalString(std::filesystem::path const& Path) {
+        std::error_code Ec;
+        std::filesystem::path Canonical = std::filesystem::weakly_canonical(Path, Ec);
+        return (Ec ? std::filesystem::absolute(Path) : Canonical).string();
+    }
+
+    int OpenSocket(std::filesystem::path const& SocketPath, bool Listen) {
+        sockaddr_un Address { };
+        Address.sun_family = AF_UNIX;
+        std::string const PathStr = SocketPath.string();
+        if (PathStr.size() >= sizeof(Address.sun_path)) {
+            throw std::runtime_error("Socket path is too long: " + PathStr);
+        }
+        memcpy(Address.sun_path, PathStr.c_str(), PathStr.size() + 1);
+
+        int Fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (Fd < 0) throw std::runtime_error("socket() failed");
+
+        if (Listen) {
+            unlink(PathStr.c_str());
+            if (bind(Fd, reinterpret_cast<sockaddr*>(&Address), sizeof(Address)) != 0 || listen(Fd, 16) != 0) {
+                close(Fd);
+                throw std::runtime_error("Could not listen on " + PathStr);
+            }
+        } else if (connect(Fd, reinterpret_cast<sockaddr*>(&Address), sizeof(Address)) != 0) {
+            close(Fd);
+            return -1;
+        }
+
+        return Fd;
+    }
+
+    std::string ReadLine(int Fd) {
+        std::string Line;
+        char C;
+        while (read(Fd, &C, 1) == 1 && C != '\n') Line += C;
+        return Line;
+    }
+
+    void WriteAll(int Fd, std::string const& Str) {
+        size_t Written = 0;
+        while (Written < Str.size()) {
+            ssize_t Res = write(Fd, Str.data() + Written, Str.size() - Written);
+            if (Res <= 0) return;
+            Written += static_cast<size_t>(Res);
+        }
+    }
+}
+#endif
+
+int RunWatcher(WatchCallbacks const& Callbacks, std::filesystem::path const& SocketPath, bool Silent) {
+#ifndef __linux__
+    std::cerr << "Watch mode requires inotify, which is only available on Linux" << std::endl;
+    return 1;
+#else
+    int Notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (Notify < 0) {
+        std::cerr << "inotify_init1() failed" << std::endl;
+        return 1;
+    }
+    CallOnDtor CloseNotify([Notify]() { close(Notify); });
+
+    int Listener = -1;
+    if (!SocketPath.empty()) Listener = OpenSocket(SocketPath, true);
+    CallOnDtor CloseListener([Listener, &SocketPath]() {
+        if (Listener < 0) return;
+        close(Listener);
+        unlink(SocketPath.c_str());
+    });
+
+    // inotify watches directories, so editors that replace files by renaming are still seen
+    std::map<int, std::string> WatchedDirs;
+    std::set<std::string> WatchedDirSet;
+    auto RefreshWatches = [&]() {
+        for (auto const& File : Callbacks.GetWatchedFiles()) {
+            std::string const Dir = std::filesystem::path(CanonicalString(File)).parent_path().string();
+            if (!WatchedDirSet.insert(Dir).second) continue;
+
+            int Wd = inotify_add_watch(Notify, Dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE);
+            if (Wd >= 0) WatchedDirs[Wd] = Dir;
+        }
+    };
+    RefreshWatches();
+
+    std::set<std::string> Pending;
+    std::optional<std::chrono::steady_clock::time_point> Deadline;
+
+    // Returns an empty string on success, otherwise the error
+    auto RegeneratePending = [&]() -> std::string {
+        std::set<std::string> Changed;
+        std::swap(Changed, Pending);
+        Deadline = std::nullopt;
+        if (Changed.empty()) return "";
+
+        try {
+            Callbacks.Regenerate(Changed);
+        } catch (std::exception const& Er) {
+            std::cerr << "Regeneration failed: " << Er.what() << std::endl;
+            return Er.what();
+        }
+
+        RefreshWatches();
+        return "";
+    };
+
+    if (!Silent) Log(SocketPath.empty() ? "watch" : SocketPath, "Watching " + std::to_string(WatchedDirs.size()) + " directories");
+
+    std::vector<char> EventBuffer(64 * 1024);
+    auto DrainEvents = [&]() {
+        ssize_t Len;
+        while ((Len = read(Notify, EventBuffer.data(), EventBuffer.size())) > 0) {
+            for (ssize_t Offset = 0; Offset < Len;) {
+                inotify_event const* Event = reinterpret_cast<inotify_event const*>(EventBuffer.data() + Offset);
+                Offset += static_cast<ssize_t>(sizeof(inotify_event) + Event->len);
+
+                auto const Dir = WatchedDirs.find(Event->wd);
+                if (Dir == WatchedDirs.end() || Event->len == 0) continue;
+
+                Pending.insert((std::filesystem::path(Dir->second) / Event->name).string());
+            }
+        }
+    };
+
+    bool Running = true;
+    while (Running) {
+        int Timeout = -1;
+        if (Deadline) {
+            auto const Remaining = std::chrono::duration_cast<std::chrono::milliseconds>(*Deadline - std::chrono::steady_clock::now());
+            Timeout = static_cast<int>(std::max<int64_t>(Remaining.count(), 0));
+        }
+
+        pollfd Fds[2] = { { Notify, POLLIN, 0 }, { Listener, POLLIN, 0 } };
+        int const NumFds = (Listener >= 0) ? 2 : 1;
+        if (poll(Fds, NumFds, Timeout) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        if (Fds[0].revents & POLLIN) {
+            DrainEvents();
+            if (!Pending.empty()) Deadline = std::chrono::steady_clock::now() + DebounceTime;
+        }
+
+        if (NumFds > 1 && (Fds[1].revents & POLLIN)) {
+            int Client = accept4(Listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (Client >= 0) {
+                CallOnDtor CloseClient([Client]() { close(Client); });
+
+                // Don't let a stuck client block the watcher
+                timeval ReadTimeout { 5, 0 };
+                setsockopt(Client, SOL_SOCKET, SO_RCVTIMEO, &ReadTimeout, sizeof(ReadTimeout));
+
+                std::string const Request = ReadLine(Client);
+                if (Request == "sync") {
+                    // Pick up events that arrived but were not read yet
+                    DrainEvents();
+
+                    std::string const Error = RegeneratePending();
+                    WriteAll(Client, Error.empty() ? "ok\n" : "error " + Error + "\n");
+                } else if (Request == "stop") {
+                    WriteAll(Client, "ok\n");
+                    Running = false;
+                } else {
+                    WriteAll(Client, "error Unknown request " + Request + "\n");
+                }
+            }
+        }
+
+        if (Deadline && std::chrono::steady_clock::now() >= *Deadline) {
+            RegeneratePending();
+        }
+    }
+
+    return 0;
+#endif
+}
+
+std::optional<int> SendWatcherRequest(std::filesystem::path const& SocketPath, std::string const& Request) {
+#ifndef __linux__
+    return std::nullopt;
+#else
+    int Fd = OpenSocket(SocketPath, false);
+    if (Fd < 0) return std::nullopt;
+    CallOnDtor CloseFd([Fd]() { close(Fd); });
+
+    WriteAll(Fd, Request + "\n");
+    std::string const Reply = ReadLine(Fd);
+
+    if (Reply == "ok") return 0;
+
+    std::cerr << (Reply.empty() ? std::string("No reply from watcher") : Reply) << std::endl;
+    return 1;
+#endif
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "Utilities.hpp"
+
+struct WatchCallbacks {
+    // Every file whose changes should trigger regeneration
+    std::function<std::vector<std::filesystem::path>()> GetWatchedFiles;
+
+    // Called with the canonical paths of files that changed, may throw to report a failure
+    std::function<void(std::set<std::string> const& ChangedFiles)> Regenerate;
+};
+
+// Stays resident, regenerating when watched files change
+// If SocketPath is not empty, build requests are also answered on a Unix socket
+int RunWatcher(WatchCallbacks const& Callbacks, std::filesystem::path const& SocketPath, bool Silent);
+
+// Sends a request ("sync" or "stop") to a resident watcher and returns its exit code
+// Returns nullopt if no watcher is listening on the socket
+std::optional<int> SendWatcherRequest(std::filesystem::path const& SocketPath, std::string const& Request);
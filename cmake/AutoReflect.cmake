@@ -0,0 +1,116 @@
+# Runs AutoReflect as part of a target's build
+#
+# autoreflect_generate(<target>
+#     [MAIN <file>]                   File that includes the main implementation, <file>.gen.inl
+#     SOURCES <files>...              Files that include their own .gen.inl
+#     [INCLUDE_DIRECTORIES <dirs>...] Passed to clang with -I
+#     [SHARDS <n>])                   See --shards, the shards are added to <target>
+#
+# AutoReflect writes a depfile next to every output, listing every header clang saw while parsing
+# With Ninja, or Makefiles on CMake 3.20 and newer, a build where none of them changed doesn't run AutoReflect at all
+# Without MAIN every source gets its own command in inline mode, so each one is regenerated and compiled on its own
+# The AutoReflect target is used if it exists, otherwise AUTOREFLECT_EXECUTABLE or an AutoReflect found on PATH
+function(autoreflect_generate TARGET)
+    cmake_parse_arguments(AR "" "MAIN;SHARDS" "SOURCES;INCLUDE_DIRECTORIES" ${ARGN})
+    if(AR_SHARDS AND NOT AR_MAIN)
+        message(FATAL_ERROR "autoreflect_generate: SHARDS needs MAIN")
+    endif()
+
+    if(TARGET AutoReflect)
+        set(Generator $<TARGET_FILE:AutoReflect>)
+        set(GeneratorDepends AutoReflect)
+    else()
+        if(NOT AUTOREFLECT_EXECUTABLE)
+            find_program(AUTOREFLECT_EXECUTABLE AutoReflect)
+        endif()
+        if(NOT AUTOREFLECT_EXECUTABLE)
+            message(FATAL_ERROR "autoreflect_generate: AutoReflect not found, set AUTOREFLECT_EXECUTABLE")
+        endif()
+        set(Generator ${AUTOREFLECT_EXECUTABLE})
+        set(GeneratorDepends ${AUTOREFLECT_EXECUTABLE})
+    endif()
+
+    # Absolute paths, so the outputs and the depfiles name the same files
+    set(Outputs)
+    set(Sources)
+    foreach(Source ${AR_SOURCES})
+        get_filename_component(Source ${Source} ABSOLUTE)
+        list(APPEND Sources ${Source})
+        list(APPEND Outputs ${Source}.gen.inl)
+    endforeach()
+
+    set(Args -S)
+    foreach(Dir ${AR_INCLUDE_DIRECTORIES})
+        get_filename_component(Dir ${Dir} ABSOLUTE)
+        list(APPEND Args -I ${Dir})
+    endforeach()
+
+    set(DepfileSupported OFF)
+    if(CMAKE_GENERATOR MATCHES "Ninja" OR NOT CMAKE_VERSION VERSION_LESS 3.20)
+        set(DepfileSupported ON)
+    endif()
+
+    if(NOT AR_MAIN)
+        # Commands can run in parallel, so each keeps its state in its own directory
+        # A precompiled header per source would cost more than it saves
+        foreach(Source ${Sources})
+            file(RELATIVE_PATH StateName ${CMAKE_SOURCE_DIR} ${Source})
+            string(MAKE_C_IDENTIFIER ${StateName} StateName)
+            set(StateDir ${CMAKE_CURRENT_BINARY_DIR}/AutoReflect/${StateName})
+            file(MAKE_DIRECTORY ${StateDir})
+
+            set(DepfileArgs)
+            if(DepfileSupported)
+                set(DepfileArgs DEPFILE ${Source}.gen.inl.d)
+            endif()
+
+            add_custom_command(
+                OUTPUT ${Source}.gen.inl
+                COMMAND ${Generator} ${Args} --no-pch ${Source}
+                DEPENDS ${GeneratorDepends} ${Source}
+                ${DepfileArgs}
+                WORKING_DIRECTORY ${StateDir}
+                COMMENT "Generating reflection code for ${Source}"
+                VERBATIM)
+        endforeach()
+
+        add_custom_target(${TARGET}_AutoReflect DEPENDS ${Outputs})
+        add_dependencies(${TARGET} ${TARGET}_AutoReflect)
+        return()
+    endif()
+
+    get_filename_component(Main ${AR_MAIN} ABSOLUTE)
+    set(MainOutput ${Main}.gen.inl)
+    list(APPEND Outputs ${MainOutput})
+    list(APPEND Args -M ${Main})
+
+    set(Shards)
+    if(AR_SHARDS)
+        list(APPEND Args --shards ${AR_SHARDS})
+        math(EXPR LastShard "${AR_SHARDS} - 1")
+        foreach(Shard RANGE ${LastShard})
+            list(APPEND Shards ${Main}.shard${Shard}.gen.cpp)
+        endforeach()
+    endif()
+
+    # The main impl depfile covers every input, the per file depfiles are there for per file commands
+    set(DepfileArgs)
+    if(DepfileSupported)
+        set(DepfileArgs DEPFILE ${MainOutput}.d)
+    endif()
+
+    add_custom_command(
+        OUTPUT ${Outputs} ${Shards}
+        COMMAND ${Generator} ${Args} ${Sources}
+        DEPENDS ${GeneratorDepends} ${Sources}
+        ${DepfileArgs}
+        WORKING_DIRECTORY ${CMAKE_CURRENT_BINARY_DIR}
+        COMMENT "Generating reflection code for ${TARGET}"
+        VERBATIM)
+
+    add_custom_target(${TARGET}_AutoReflect DEPENDS ${Outputs} ${Shards})
+    add_dependencies(${TARGET} ${TARGET}_AutoReflect)
+    if(Shards)
+        target_sources(${TARGET} PRIVATE ${Shards})
+    endif()
+endfunction()